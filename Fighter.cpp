@@ -2,71 +2,70 @@
 #include <iostream>
 #include <cmath>
 #include <cstdio>
-#include <GL/glew.h>
-#include "glutils.h"
-#include <glm/gtc/matrix_transform.hpp>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include "render.h"
 #include "explosion.h"
+#include "audio.h"
 #include "ParamReader.h"
+#include "trace.h"
 
-const static int AIR_NORMAL_STATE = 0;
-const static int AIR_STUNNED_STATE = 1;
-const static int GROUND_STATE = 2;
-const static int DEAD_STATE = 3;
+// Where each AttackID's params start and the sound it plays on hit
+static const struct
+{
+    ParamID params;
+    const char *sound;
+} attackDefs[NUM_ATTACKS] =
+{
+    { P_DASH_ATTACK, "sfx/neutral001.wav" },
+    { P_NEUTRAL_TILT_ATTACK, "sfx/neutral001.wav" },
+    { P_SIDE_TILT_ATTACK, "sfx/forwardtilt001.wav" },
+    { P_DOWN_TILT_ATTACK, "sfx/downtilt001.wav" },
+    { P_UP_TILT_ATTACK, "sfx/uptilt001.wav" },
+    { P_AIR_NEUTRAL_ATTACK, "sfx/uptilt001.wav" },
+    { P_AIR_SIDE_ATTACK, "sfx/uptilt001.wav" },
+    { P_AIR_DOWN_ATTACK, "sfx/uptilt001.wav" },
+    { P_AIR_UP_ATTACK, "sfx/uptilt001.wav" },
+};
 
-static sf::Music *koSound = NULL;
+static const char KO_SOUND_FILE[] = "sfx/ko001.wav";
+
+// Loaded the first time a Fighter is made, shared by all of them
+static int koSound()
+{
+    static int sound = load_sound(KO_SOUND_FILE);
+    return sound;
+}
 
-Fighter::Fighter(const ParamReader &params, float respawnx, float respawny, const glm::vec3& color) :
-    rect_(Rectangle(0, 0, params.get("fighter.w"), params.get("fighter.h"))),
+Fighter::Fighter(const ParamReader &params, float respawnx, float respawny,
+        const glm::vec3& color, ExplosionManager *explosions, int id) :
+    rect_(Rectangle(0, 0, params.get(P_FIGHTER_W), params.get(P_FIGHTER_H))),
+    lastRect_(rect_),
     xvel_(0), yvel_(0),
     dir_(-1),
-    state_(AIR_NORMAL_STATE),
-    damage_(0), lives_(params.get("fighter.lives")),
+    hasNext_(false),
+    damage_(0), lives_(params.get(P_FIGHTER_LIVES)),
+    id_(id),
     respawnx_(respawnx), respawny_(respawny),
     color_(color),
-    attack_(NULL),
-    walkSpeed_(params.get("walkSpeed")),
-    dashSpeed_(params.get("dashSpeed")),
-    airForce_(params.get("airForce")),
-    airAccel_(params.get("airAccel")),
-    jumpStartupTime_(params.get("jumpStartupTime")),
-    jumpSpeed_(params.get("jumpSpeed")),
-    hopSpeed_(params.get("hopSpeed")),
-    jumpAirSpeed_(params.get("jumpAirSpeed")),
-    secondJumpSpeed_(params.get("secondJumpSpeed")),
-    dashStartupTime_(params.get("dashStartupTime")),
-    inputVelocityThresh_(params.get("input.velThresh")),
-    inputJumpThresh_(params.get("input.jumpThresh")),
-    inputDashThresh_(params.get("input.dashThresh")),
-    inputDashMin_(params.get("input.dashMin")),
-    inputDeadzone_(params.get("input.deadzone")),
-    inputTiltThresh_(params.get("input.tiltThresh"))
-{
-    std::cout << "RESPAWN: " << respawnx_ << ' ' << respawny_ << '\n';
-    // Load ground attacks
-    dashAttack_ = loadAttack(params, "dashAttack", "sfx/neutral001.wav");
-    neutralTiltAttack_ = loadAttack(params, "neutralTiltAttack", "sfx/neutral001.wav");
-    sideTiltAttack_ = loadAttack(params, "sideTiltAttack", "sfx/forwardtilt001.wav");
-    downTiltAttack_ = loadAttack(params, "downTiltAttack", "sfx/downtilt001.wav");
-    upTiltAttack_ = loadAttack(params, "upTiltAttack", "sfx/uptilt001.wav");
-
-    // Load air attack special as it uses a different class
-    airNeutralAttack_ = loadAttack(params, "airNeutralAttack", "sfx/uptilt001.wav");
-    airSideAttack_ = loadAttack(params, "airSideAttack", "sfx/uptilt001.wav");
-    airDownAttack_ = loadAttack(params, "airDownAttack", "sfx/uptilt001.wav");
-    airUpAttack_ = loadAttack(params, "airUpAttack", "sfx/uptilt001.wav");
-
-    state_ = 0;
-
-    // Load some audio
-    if (!koSound)
-    {
-        koSound = new sf::Music();
-        koSound->OpenFromFile("sfx/ko001.wav");
-    }
+    explosions_(explosions),
+    koSound_(koSound())
+{
+    endAttack();
+    memset(&state_, 0, sizeof(state_));
+    memset(&next_, 0, sizeof(next_));
+    state_.id = AIR_NORMAL_STATE;
+    state_.airNormal.enter(this);
+
+    loadStats(params);
+    for (unsigned i = 0; i < NUM_ATTACKS; i++)
+        attacks_[i] = loadAttack(params, attackDefs[i].params, attackDefs[i].sound);
 }
 
 Fighter::~Fighter()
-{}
+{
+}
 
 int Fighter::getLives() const
 {
@@ -85,27 +84,44 @@ float Fighter::getDirection() const
 
 void Fighter::update(const struct Controller &controller, float dt)
 {
+    TraceScope span(TRACE_FIGHTER_UPDATE_SPAN, id_);
+    lastRect_ = rect_;
+
     // Check for state transition
-    if (state_->hasTransition())
+    if (hasNext_)
     {
-        FighterState *next = state_->nextState();
-        delete state_;
-        state_ = next;
+        if (trace_enabled(TRACE_EVENTS))
+        {
+            float values[] = { float(state_.id), float(next_.id) };
+            trace_record(TRACE_STATE_CHANGE, id_, values, 2);
+        }
+        state_ = next_;
+        hasNext_ = false;
     }
 
     // Update the attack
-    if (attack_)
+    if (isAttacking())
     {
-        attack_->update(dt);
-        if (attack_->isDone())
-        {
-            delete attack_;
-            attack_ = NULL;
-        }
+        attack_.t += dt;
+        if (attacks_[attack_.id].isDone(attack_.t))
+            endAttack();
     }
 
     // Update state
-    state_->update(controller, dt);
+    switch (state_.id)
+    {
+    case GROUND_STATE:
+        state_.ground.update(this, controller, dt);
+        break;
+    case AIR_NORMAL_STATE:
+        state_.airNormal.update(this, controller, dt);
+        break;
+    case AIR_STUNNED_STATE:
+        state_.airStunned.update(this, controller, dt);
+        break;
+    case DEAD_STATE:
+        break;
+    }
 
     // Update position
     rect_.x += xvel_ * dt;
@@ -114,27 +130,56 @@ void Fighter::update(const struct Controller &controller, float dt)
 
 void Fighter::collisionWithGround(const Rectangle &ground, bool collision)
 {
-    state_->collisionWithGround(ground, collision);
+    switch (state_.id)
+    {
+    case GROUND_STATE:
+        state_.ground.collisionWithGround(this, ground, collision);
+        break;
+    case AIR_NORMAL_STATE:
+        state_.airNormal.collisionWithGround(this, ground, collision);
+        break;
+    case AIR_STUNNED_STATE:
+        state_.airStunned.collisionWithGround(this, ground, collision);
+        break;
+    case DEAD_STATE:
+        assert(false);
+        break;
+    }
 }
 
 void Fighter::attackCollision()
 {
     // If two attacks collide, just cancel them and go to cooldown
-    assert(attack_);
-    attack_->cancel();
+    assert(isAttacking());
+    cancelAttack();
 }
 
-void Fighter::hitByAttack(const Fighter *fighter, const Attack *inAttack)
+void Fighter::hitByAttack(const Hit *hits, unsigned nhits)
 {
-    assert(inAttack);
-    assert(fighter);
-    state_->hitByAttack(fighter, inAttack);
+    assert(hits);
+    assert(nhits > 0);
+    switch (state_.id)
+    {
+    case GROUND_STATE:
+        state_.ground.hitByAttack(this, hits, nhits);
+        break;
+    case AIR_NORMAL_STATE:
+        state_.airNormal.hitByAttack(this, hits, nhits);
+        break;
+    case AIR_STUNNED_STATE:
+        state_.airStunned.hitByAttack(this, hits, nhits);
+        break;
+    case DEAD_STATE:
+        assert(false);
+        break;
+    }
 }
 
 void Fighter::hitWithAttack()
 {
-    assert(attack_);
-    attack_->hit();
+    assert(isAttacking());
+    attack_.hasHit = true;
+    play_sound(attacks_[attack_.id].getSound());
 }
 
 const Rectangle& Fighter::getRectangle() const
@@ -144,12 +189,91 @@ const Rectangle& Fighter::getRectangle() const
 
 bool Fighter::hasAttack() const
 {
-    return attack_ && attack_->hasHitbox();
+    return isAttacking() && !attack_.hasHit
+        && attacks_[attack_.id].hasHitbox(attack_.t);
+}
+
+Rectangle Fighter::getAttackHitbox() const
+{
+    assert(isAttacking());
+    return attacks_[attack_.id].getHitbox(rect_, dir_);
+}
+
+Hit Fighter::getAttackHit(const Fighter *target) const
+{
+    assert(isAttacking());
+    const Attack &attack = attacks_[attack_.id];
+    Hit hit;
+    hit.damage = attack.getDamage();
+    hit.stun = attack.getStun();
+    hit.knockback = attack.getKnockback() * glm::vec2(dir_, 1.0f);
+    hit.hitbox = attack.getHitbox(rect_, dir_);
+    return hit;
+}
+
+bool Fighter::isAttacking() const
+{
+    return attack_.id != NO_ATTACK;
+}
+
+void Fighter::startAttack(AttackID id)
+{
+    attack_.id = id;
+    attack_.t = 0.0f;
+    attack_.hasHit = false;
+}
+
+void Fighter::cancelAttack()
+{
+    if (isAttacking())
+        attack_.t = attacks_[attack_.id].getCancelTime();
+}
+
+void Fighter::endAttack()
+{
+    attack_.id = NO_ATTACK;
+    attack_.t = 0.0f;
+    attack_.hasHit = false;
 }
 
-const Attack * Fighter::getAttack() const
+void Fighter::getSoundFiles(std::vector<const char *> &files)
 {
-    return attack_;
+    std::vector<const char *> all;
+    all.push_back(KO_SOUND_FILE);
+    for (unsigned i = 0; i < NUM_ATTACKS; i++)
+        all.push_back(attackDefs[i].sound);
+
+    for (unsigned i = 0; i < all.size(); i++)
+    {
+        bool found = false;
+        for (unsigned j = 0; j < files.size() && !found; j++)
+            found = strcmp(files[j], all[i]) == 0;
+        if (!found)
+            files.push_back(all[i]);
+    }
+}
+
+void Fighter::reloadParams(const ParamReader &params, const bool *changed)
+{
+    // Plain stats are cheaper to copy than to check
+    loadStats(params);
+    rect_.w = lastRect_.w = params.get(P_FIGHTER_W);
+    rect_.h = lastRect_.h = params.get(P_FIGHTER_H);
+
+    // Attacks keep the sound they already loaded.  attack_ only refers to
+    // its template by id, so its timer is untouched.
+    for (unsigned i = 0; i < NUM_ATTACKS; i++)
+    {
+        ParamID block = attackDefs[i].params;
+        bool dirty = false;
+        for (unsigned j = 0; j < NUM_ATTACK_PARAMS; j++)
+            dirty = dirty || changed[block + j];
+        if (!dirty)
+            continue;
+        int sound = attacks_[i].getSound();
+        attacks_[i] = loadAttack(params, block);
+        attacks_[i].setSound(sound);
+    }
 }
 
 void Fighter::respawn(bool killed)
@@ -157,28 +281,28 @@ void Fighter::respawn(bool killed)
     // Reset vars
     rect_.x = respawnx_;
     rect_.y = respawny_;
+    lastRect_ = rect_;
     xvel_ = yvel_ = 0.0f;
     damage_ = 0;
-    // Set state to air normal
-    delete state_;
-    state_ = new AirNormalState(this);
+    // Set state to air normal, dropping any pending transition
+    memset(&state_, 0, sizeof(state_));
+    state_.id = AIR_NORMAL_STATE;
+    state_.airNormal.enter(this);
+    hasNext_ = false;
     // Remove any attacks
-    if (attack_)
-    {
-        delete attack_;
-        attack_ = 0;
-    }
+    endAttack();
     // If we died remove a life and play a sound
     if (killed)
     {
         --lives_;
-        koSound->Play();
+        play_sound(koSound_);
     }
     // Check for death
     if (lives_ <= 0)
     {
-        delete state_;
-        state_ = new DeadState(this);
+        memset(&state_, 0, sizeof(state_));
+        state_.id = DEAD_STATE;
+        state_.dead.enter(this);
     }
 }
 
@@ -187,40 +311,168 @@ bool Fighter::isAlive() const
     return lives_ > 0;
 }
 
-void Fighter::render(float dt)
+void Fighter::save(FighterSnapshot &snapshot) const
+{
+    snapshot.rect = rect_;
+    snapshot.lastRect = lastRect_;
+    snapshot.xvel = xvel_;
+    snapshot.yvel = yvel_;
+    snapshot.dir = dir_;
+    snapshot.damage = damage_;
+    snapshot.lives = lives_;
+    snapshot.state = state_;
+    snapshot.next = next_;
+    snapshot.hasNext = hasNext_;
+    snapshot.attackID = attack_.id;
+    snapshot.attackT = attack_.t;
+    snapshot.attackHasHit = attack_.hasHit;
+}
+
+void Fighter::restore(const FighterSnapshot &snapshot)
+{
+    rect_ = snapshot.rect;
+    lastRect_ = snapshot.lastRect;
+    xvel_ = snapshot.xvel;
+    yvel_ = snapshot.yvel;
+    dir_ = snapshot.dir;
+    damage_ = snapshot.damage;
+    lives_ = snapshot.lives;
+    state_ = snapshot.state;
+    next_ = snapshot.next;
+    hasNext_ = snapshot.hasNext;
+    attack_.id = snapshot.attackID;
+    attack_.t = snapshot.attackT;
+    attack_.hasHit = snapshot.attackHasHit;
+}
+
+// Field names of the states, by FighterStateID
+static const char *stateFieldNames[] =
+{
+    "ground", "airNormal", "airStunned", "dead"
+};
+typedef char stateFieldNamesCheck[
+    sizeof(stateFieldNames) / sizeof(stateFieldNames[0]) == DEAD_STATE + 1 ? 1 : -1];
+
+// Adds "name: a vs b" to diffs unless a and b are the same bits, which is
+// what a checksum compares
+template <typename T>
+static void diffField(const std::string &name, const T &a, const T &b,
+        std::vector<std::string> &diffs)
+{
+    if (memcmp(&a, &b, sizeof(T)) == 0)
+        return;
+    std::ostringstream line;
+    line << std::setprecision(9) << name << ": " << a << " vs " << b;
+    diffs.push_back(line.str());
+}
+
+static void diffRectangle(const std::string &name, const Rectangle &a,
+        const Rectangle &b, std::vector<std::string> &diffs)
 {
-    state_->render(dt);
+    diffField(name + ".x", a.x, b.x, diffs);
+    diffField(name + ".y", a.y, b.y, diffs);
+    diffField(name + ".w", a.w, b.w, diffs);
+    diffField(name + ".h", a.h, b.h, diffs);
 }
 
-void Fighter::renderHelper(float dt, const glm::vec3 &color)
+static unsigned getStateFields(const FighterState &state, const char **names,
+        float *values)
 {
-    printf("Damage: %f  Position: [%f, %f]   Velocity: [%f, %f]  Attack: %d  Dir: %f\n", 
-            damage_, rect_.x, rect_.y, xvel_, yvel_, attack_ != 0, dir_);
+    switch (state.id)
+    {
+    case GROUND_STATE:
+        return state.ground.getFields(names, values);
+    case AIR_NORMAL_STATE:
+        return state.airNormal.getFields(names, values);
+    case AIR_STUNNED_STATE:
+        return state.airStunned.getFields(names, values);
+    default:
+        return 0;
+    }
+}
 
-    // Draw body
-    glm::mat4 transform(1.0);
-    transform = glm::scale(
-            glm::translate(glm::mat4(1.0f), glm::vec3(rect_.x, rect_.y, 0.0)),
-            glm::vec3(rect_.w, rect_.h, 1.0));
-    renderRectangle(transform, color);
+static void diffState(const std::string &name, const FighterState &a,
+        const FighterState &b, std::vector<std::string> &diffs)
+{
+    if (a.id != b.id)
+    {
+        diffs.push_back(name + ": " + stateFieldNames[a.id] + " vs "
+                + stateFieldNames[b.id]);
+        return;
+    }
+    const char *names[MAX_STATE_FIELDS];
+    float avalues[MAX_STATE_FIELDS], bvalues[MAX_STATE_FIELDS];
+    unsigned n = getStateFields(a, names, avalues);
+    getStateFields(b, names, bvalues);
+    for (unsigned i = 0; i < n; i++)
+        diffField(name + '.' + stateFieldNames[a.id] + '.' + names[i],
+                avalues[i], bvalues[i], diffs);
+}
+
+void FighterSnapshot::diff(const FighterSnapshot &other,
+        std::vector<std::string> &diffs) const
+{
+    diffRectangle("rect", rect, other.rect, diffs);
+    diffRectangle("lastRect", lastRect, other.lastRect, diffs);
+    diffField("xvel", xvel, other.xvel, diffs);
+    diffField("yvel", yvel, other.yvel, diffs);
+    diffField("dir", dir, other.dir, diffs);
+    diffField("damage", damage, other.damage, diffs);
+    diffField("lives", lives, other.lives, diffs);
+    diffState("state", state, other.state, diffs);
+    diffField("hasNext", hasNext, other.hasNext, diffs);
+    diffState("next", next, other.next, diffs);
+    diffField("attack.id", attackID, other.attackID, diffs);
+    diffField("attack.t", attackT, other.attackT, diffs);
+    diffField("attack.hasHit", attackHasHit, other.attackHasHit, diffs);
+}
+
+void Fighter::render(float dt, float alpha)
+{
+    switch (state_.id)
+    {
+    case GROUND_STATE:
+        state_.ground.render(this, dt, alpha);
+        break;
+    case AIR_NORMAL_STATE:
+        state_.airNormal.render(this, dt, alpha);
+        break;
+    case AIR_STUNNED_STATE:
+        state_.airStunned.render(this, dt, alpha);
+        break;
+    case DEAD_STATE:
+        break;
+    }
+}
+
+void Fighter::renderHelper(float dt, float alpha, const glm::vec3 &color)
+{
+    if (trace_enabled(TRACE_FIGHTER))
+    {
+        float values[] = { damage_, rect_.x, rect_.y, xvel_, yvel_,
+            float(isAttacking()), dir_ };
+        trace_record(TRACE_FIGHTER_STATUS, id_, values, 7);
+    }
+
+    // Draw body, somewhere between the last and current positions
+    glm::vec2 pos = glm::mix(glm::vec2(lastRect_.x, lastRect_.y),
+            glm::vec2(rect_.x, rect_.y), alpha);
+    glm::vec2 size(rect_.w, rect_.h);
+    renderRectangle(pos, size, color);
 
     // Draw orientation tick
-    float angle = 0;
-    glm::mat4 ticktrans = glm::scale(
-            glm::rotate(
-                glm::translate(transform, glm::vec3(0.5 * dir_, 0.0, 0.0)),
-                angle, glm::vec3(0.0, 0.0, -1.0)),
-            glm::vec3(0.33, 0.1, 1.0));
-    renderRectangle(ticktrans, color);
+    renderRectangle(pos + glm::vec2(0.5f * dir_ * size.x, 0.0f),
+            size * glm::vec2(0.33f, 0.1f), color);
 
     // Draw hitbox if applicable
-    if (attack_ && attack_->drawHitbox())
+    if (isAttacking() && attacks_[attack_.id].drawHitbox(attack_.t))
     {
-        Rectangle hitbox = attack_->getHitbox();
-        glm::mat4 attacktrans = glm::scale(
-                glm::translate(glm::mat4(1.0f), glm::vec3(hitbox.x, hitbox.y, 0)),
-                glm::vec3(hitbox.w, hitbox.h, 1.0f));
-        renderRectangle(attacktrans, glm::vec3(1,0,0));
+        Rectangle hitbox = getAttackHitbox();
+        // Keep the hitbox with the interpolated body
+        hitbox.x += pos.x - rect_.x;
+        hitbox.y += pos.y - rect_.y;
+        renderRectangle(glm::vec2(hitbox.x, hitbox.y), glm::vec2(hitbox.w, hitbox.h),
+                glm::vec3(1,0,0));
     }
 }
 
@@ -229,155 +481,204 @@ float Fighter::damageFunc() const
     return 2 * damage_ / 33;
 }
 
-Attack Fighter::loadAttack(const ParamReader &params, std::string attackName,
-        std::string soundFile)
+void Fighter::loadStats(const ParamReader &params)
 {
-    attackName += '.';
+    walkSpeed_ = params.get(P_WALK_SPEED);
+    dashSpeed_ = params.get(P_DASH_SPEED);
+    airForce_ = params.get(P_AIR_FORCE);
+    airAccel_ = params.get(P_AIR_ACCEL);
+    jumpStartupTime_ = params.get(P_JUMP_STARTUP_TIME);
+    jumpSpeed_ = params.get(P_JUMP_SPEED);
+    hopSpeed_ = params.get(P_HOP_SPEED);
+    jumpAirSpeed_ = params.get(P_JUMP_AIR_SPEED);
+    secondJumpSpeed_ = params.get(P_SECOND_JUMP_SPEED);
+    dashStartupTime_ = params.get(P_DASH_STARTUP_TIME);
+    inputVelocityThresh_ = params.get(P_INPUT_VEL_THRESH);
+    inputJumpThresh_ = params.get(P_INPUT_JUMP_THRESH);
+    inputDashThresh_ = params.get(P_INPUT_DASH_THRESH);
+    inputDashMin_ = params.get(P_INPUT_DASH_MIN);
+    inputDeadzone_ = params.get(P_INPUT_DEADZONE);
+    inputTiltThresh_ = params.get(P_INPUT_TILT_THRESH);
+}
 
+Attack Fighter::loadAttack(const ParamReader &params, ParamID block,
+        const char *soundFile)
+{
     Attack ret(
-            params.get(attackName + "startup"),
-            params.get(attackName + "duration"),
-            params.get(attackName + "cooldown"),
-            params.get(attackName + "damage"),
-            params.get(attackName + "stun"),
-            params.get(attackName + "knockbackpow") * glm::normalize(glm::vec2(
-                    params.get(attackName + "knockbackx"),
-                    params.get(attackName + "knockbacky"))),
+            params.get(block, ATTACK_STARTUP),
+            params.get(block, ATTACK_DURATION),
+            params.get(block, ATTACK_COOLDOWN),
+            params.get(block, ATTACK_DAMAGE),
+            params.get(block, ATTACK_STUN),
+            params.get(block, ATTACK_KNOCKBACKPOW) * glm::normalize(glm::vec2(
+                    params.get(block, ATTACK_KNOCKBACKX),
+                    params.get(block, ATTACK_KNOCKBACKY))),
             Rectangle(
-                params.get(attackName + "hitboxx"),
-                params.get(attackName + "hitboxy"),
-                params.get(attackName + "hitboxw"),
-                params.get(attackName + "hitboxh")));
+                params.get(block, ATTACK_HITBOXX),
+                params.get(block, ATTACK_HITBOXY),
+                params.get(block, ATTACK_HITBOXW),
+                params.get(block, ATTACK_HITBOXH)));
 
-    if (!soundFile.empty())
-    {
-        sf::Music *m = new sf::Music();
-        m->OpenFromFile(soundFile);
-        ret.setSound(m);
-    }
+    if (soundFile)
+        ret.setSound(load_sound(soundFile));
 
     return ret;
-
 }
 
 // ----------------------------------------------------------------------------
-// FighterState class methods
+// Fighter state methods
 // ----------------------------------------------------------------------------
 
-void FighterState::calculateHitResult(const Fighter *attacker, const Attack *attack)
+void Fighter::calculateHitResult(const Hit *hits, unsigned nhits)
 {
     // Cancel any current attack
-    if (fighter_->attack_)
+    endAttack();
+    // Take damage from every hit first, so knockback scales with the total
+    for (unsigned i = 0; i < nhits; i++)
+        damage_ += hits[i].damage;
+
+    // Simultaneous hits add their knockback, and the longest stun wins
+    glm::vec2 knockback(0.0f);
+    float stun = 0.0f;
+    for (unsigned i = 0; i < nhits; i++)
     {
-        delete fighter_->attack_;
-        fighter_->attack_ = 0;
+        knockback += hits[i].knockback;
+        stun = std::max(stun, hits[i].stun);
     }
-    // Take damage
-    fighter_->damage_ += attack->getDamage(fighter_);
-
-    // Calculate direction of hit
-    glm::vec2 knockback = attack->getKnockback(fighter_) * glm::vec2(attacker->dir_, 1.0f)
-        * fighter_->damageFunc();
+    knockback *= damageFunc();
 
     // Get knocked back
-    fighter_->xvel_ = knockback.x;
-    fighter_->yvel_ = knockback.y;
+    xvel_ = knockback.x;
+    yvel_ = knockback.y;
 
-    // Generate a tiny explosion here
-    glm::vec2 hitdir = glm::vec2(fighter_->rect_.x, fighter_->rect_.y)
-        - glm::vec2(attack->getHitbox().x, attack->getHitbox().y);
-    hitdir = glm::normalize(hitdir);
-    float exx = -hitdir.x * fighter_->rect_.w / 2 + fighter_->rect_.x;
-    float exy = -hitdir.y * fighter_->rect_.h / 2 + fighter_->rect_.y;
-    ExplosionManager::get()->addExplosion(exx, exy, 0.2);
+    // Generate a tiny explosion where each hit landed
+    for (unsigned i = 0; i < nhits; i++)
+    {
+        glm::vec2 hitdir = glm::vec2(rect_.x, rect_.y)
+            - glm::vec2(hits[i].hitbox.x, hits[i].hitbox.y);
+        hitdir = glm::normalize(hitdir);
+        float exx = -hitdir.x * rect_.w / 2 + rect_.x;
+        float exy = -hitdir.y * rect_.h / 2 + rect_.y;
+        explosions_->addExplosion(exx, exy, 0.2);
+    }
 
     // Go to the stunned state
-    float stunDuration = attack->getStun(fighter_) * fighter_->damageFunc();
-    next_ = new AirStunnedState(fighter_, stunDuration);
+    float stunDuration = stun * damageFunc();
+    nextAirStunnedState(stunDuration);
 }
 
-//// ---------------------- AIR STUNNED STATE -----------------------
-AirStunnedState::AirStunnedState(Fighter *f, float duration) : 
-    FighterState(f), stunDuration_(duration), stunTime_(0)
+void Fighter::nextGroundState()
+{
+    memset(&next_, 0, sizeof(next_));
+    next_.id = GROUND_STATE;
+    next_.ground.enter(this);
+    hasNext_ = true;
+}
+
+void Fighter::nextAirNormalState()
 {
+    memset(&next_, 0, sizeof(next_));
+    next_.id = AIR_NORMAL_STATE;
+    next_.airNormal.enter(this);
+    hasNext_ = true;
 }
 
-AirStunnedState::~AirStunnedState()
+void Fighter::nextAirStunnedState(float duration)
+{
+    memset(&next_, 0, sizeof(next_));
+    next_.id = AIR_STUNNED_STATE;
+    next_.airStunned.enter(this, duration);
+    hasNext_ = true;
+}
+
+//// ---------------------- AIR STUNNED STATE -----------------------
+void AirStunnedState::enter(Fighter *f, float duration)
 {
+    stunDuration_ = duration;
+    stunTime_ = 0;
 }
 
-void AirStunnedState::update(const Controller&, float dt)
+void AirStunnedState::update(Fighter *f, const Controller&, float dt)
 {
     // Gravity
-    fighter_->yvel_ += fighter_->airAccel_ * dt;
+    f->yvel_ += f->airAccel_ * dt;
 
     // Check for completetion
     if ((stunTime_ += dt) > stunDuration_)
-        next_ = new AirNormalState(fighter_);
+        f->nextAirNormalState();
 }
 
-void AirStunnedState::render(float dt)
+void AirStunnedState::render(Fighter *f, float dt, float alpha)
 {
-    printf("AIR STUNNED | StunTime: %f  StunDuration: %f || ",
-            stunTime_, stunDuration_);
+    if (trace_enabled(TRACE_STATE))
+    {
+        float values[] = { stunTime_, stunDuration_ };
+        trace_record(TRACE_AIR_STUNNED_STATE, f->id_, values, 2);
+    }
     // flash the player 
     float period_scale_factor = 20.0;
     float opacity_amplitude = 3;
     float opacity_factor = (1 + cos(period_scale_factor * stunTime_)) * 0.5f; 
-    glm::vec3 color = fighter_->color_ * (opacity_amplitude * opacity_factor + 1);
+    glm::vec3 color = f->color_ * (opacity_amplitude * opacity_factor + 1);
 
-    fighter_->renderHelper(dt, color);
+    f->renderHelper(dt, alpha, color);
 }
 
-void AirStunnedState::collisionWithGround(const Rectangle &ground, bool collision)
+void AirStunnedState::collisionWithGround(Fighter *f, const Rectangle &ground, bool collision)
 {
     // If no collision, we don't care
     if (!collision)
         return;
     // If we're completely below the ground, no 'real' collision
-    if (fighter_->rect_.y + fighter_->rect_.h/2 < ground.y + ground.h/2)
+    if (f->rect_.y + f->rect_.h/2 < ground.y + ground.h/2)
         return;
     // Overlap the ground by just one unit, only if some part of us is above
-    fighter_->rect_.y = ground.y + ground.h/2 + fighter_->rect_.h/2 - 1;
+    f->rect_.y = ground.y + ground.h/2 + f->rect_.h/2 - 1;
     // Transition to the ground state
-    if (next_) delete next_;
-    next_ = new GroundState(fighter_);
+    f->nextGroundState();
 }
 
-void AirStunnedState::hitByAttack(const Fighter *attacker, const Attack *attack)
+void AirStunnedState::hitByAttack(Fighter *f, const Hit *hits, unsigned nhits)
 {
-    FighterState::calculateHitResult(attacker, attack);
+    f->calculateHitResult(hits, nhits);
+}
+
+unsigned AirStunnedState::getFields(const char **names, float *values) const
+{
+    names[0] = "stunDuration";
+    values[0] = stunDuration_;
+    names[1] = "stunTime";
+    values[1] = stunTime_;
+    return 2;
 }
 
 //// ------------------------ GROUND STATE -------------------------
-GroundState::GroundState(Fighter *f) :
-    FighterState(f), jumpTime_(-1), dashTime_(-1), dashChangeTime_(-1),
-    dashing_(false)
+void GroundState::enter(Fighter *f)
 {
+    jumpTime_ = -1;
+    dashTime_ = -1;
+    dashChangeTime_ = -1;
+    dashing_ = false;
     f->xvel_ = 0;
     f->yvel_ = 0;
-    if (f->attack_)
-        f->attack_->cancel();
+    f->cancelAttack();
 }
 
-GroundState::~GroundState()
-{ /* Empty */ }
-
-void GroundState::update(const Controller &controller, float dt)
+void GroundState::update(Fighter *f, const Controller &controller, float dt)
 {
     // Update running timers
     if (jumpTime_ >= 0) jumpTime_ += dt;
     if (dashTime_ >= 0) dashTime_ += dt;
     if (dashChangeTime_ >= 0) dashChangeTime_ += dt;
     // If the fighter is currently attacking, do nothing else
-    if (fighter_->attack_) return;
+    if (f->isAttacking()) return;
     // Do nothing during jump startup
-    if (jumpTime_ > 0 && jumpTime_ < fighter_->jumpStartupTime_)
+    if (jumpTime_ > 0 && jumpTime_ < f->jumpStartupTime_)
         return;
     // Do nothing during dash startup
-    if (dashTime_ > 0 && dashTime_ < fighter_->dashStartupTime_)
+    if (dashTime_ > 0 && dashTime_ < f->dashStartupTime_)
         return;
-    if (dashChangeTime_ > 0 && dashChangeTime_ < fighter_->dashStartupTime_)
+    if (dashChangeTime_ > 0 && dashChangeTime_ < f->dashStartupTime_)
         return;
 
     // --- Deal with dashing movement ---
@@ -385,32 +686,32 @@ void GroundState::update(const Controller &controller, float dt)
     {
         int newdir = controller.joyx < 0 ? -1 : 1;
         // Check for change of dash direction
-        if (fighter_->dir_ != newdir && fabs(controller.joyxv) > fighter_->inputVelocityThresh_ && fabs(controller.joyx) > fighter_->inputDashMin_)
+        if (f->dir_ != newdir && fabs(controller.joyxv) > f->inputVelocityThresh_ && fabs(controller.joyx) > f->inputDashMin_)
         {
-            fighter_->dir_ = newdir;
+            f->dir_ = newdir;
             dashChangeTime_ = 0;
-            fighter_->xvel_ = 0;
+            f->xvel_ = 0;
             // Draw a little puff
-            ExplosionManager::get()->addPuff(
-                    fighter_->rect_.x - fighter_->rect_.w * fighter_->dir_ * 0.4f, 
-                    fighter_->rect_.y - fighter_->rect_.h * 0.45f,
+            f->explosions_->addPuff(
+                    f->rect_.x - f->rect_.w * f->dir_ * 0.4f, 
+                    f->rect_.y - f->rect_.h * 0.45f,
                     0.3f);
         }
         // Check for drop out of dash
-        else if (fabs(controller.joyx) < fighter_->inputDashMin_ && fabs(controller.joyxv) < fighter_->inputVelocityThresh_)
+        else if (fabs(controller.joyx) < f->inputDashMin_ && fabs(controller.joyxv) < f->inputVelocityThresh_)
         {
             dashing_ = false;
             dashChangeTime_ = 0;
-            fighter_->xvel_ = 0;
-            ExplosionManager::get()->addPuff(
-                    fighter_->rect_.x + fighter_->rect_.w * fighter_->dir_ * 0.4f, 
-                    fighter_->rect_.y - fighter_->rect_.h * 0.45f,
+            f->xvel_ = 0;
+            f->explosions_->addPuff(
+                    f->rect_.x + f->rect_.w * f->dir_ * 0.4f, 
+                    f->rect_.y - f->rect_.h * 0.45f,
                     0.3f);
         }
         // Otherwise just set the velocity
         else
         {
-            fighter_->xvel_ = fighter_->dir_ * fighter_->dashSpeed_;
+            f->xvel_ = f->dir_ * f->dashSpeed_;
             // TODO add puffs every x amount of time
         }
     }
@@ -418,53 +719,53 @@ void GroundState::update(const Controller &controller, float dt)
     else
     {
         // Just move around a bit based on the controller
-        if (fabs(controller.joyx) > fighter_->inputDeadzone_)
+        if (fabs(controller.joyx) > f->inputDeadzone_)
         {
-            fighter_->xvel_ = controller.joyx * fighter_->walkSpeed_;
-            fighter_->dir_ = fighter_->xvel_ < 0 ? -1 : 1;
+            f->xvel_ = controller.joyx * f->walkSpeed_;
+            f->dir_ = f->xvel_ < 0 ? -1 : 1;
         }
         // Only move when controller is held
         else
-            fighter_->xvel_ = 0;
+            f->xvel_ = 0;
 
         // --- Check for dashing ---
-        if (dashTime_ > fighter_->dashStartupTime_)
+        if (dashTime_ > f->dashStartupTime_)
         {
             dashing_ = true;
             dashTime_ = -1;
         }
-        else if (fabs(controller.joyx) > fighter_->inputDashThresh_ && fabs(controller.joyxv) > fighter_->inputVelocityThresh_)
+        else if (fabs(controller.joyx) > f->inputDashThresh_ && fabs(controller.joyxv) > f->inputVelocityThresh_)
         {
             dashTime_ = 0;
-            fighter_->xvel_ = 0;
-            fighter_->dir_ = controller.joyx < 0 ? -1 : 1;
+            f->xvel_ = 0;
+            f->dir_ = controller.joyx < 0 ? -1 : 1;
             // Draw a little puff
-            ExplosionManager::get()->addPuff(
-                    fighter_->rect_.x - fighter_->rect_.w * fighter_->dir_ * 0.4f, 
-                    fighter_->rect_.y - fighter_->rect_.h * 0.45f,
+            f->explosions_->addPuff(
+                    f->rect_.x - f->rect_.w * f->dir_ * 0.4f, 
+                    f->rect_.y - f->rect_.h * 0.45f,
                     0.3f);
         }
     }
 
     // --- Deal with jumping ---
-    if (jumpTime_ > fighter_->jumpStartupTime_)
+    if (jumpTime_ > f->jumpStartupTime_)
     {
         // Jump; transition to Air Normal
-        next_ = new AirNormalState(fighter_);
+        f->nextAirNormalState();
         // Set the xvelocity of the jump
-        fighter_->xvel_ = fabs(controller.joyx) > fighter_->inputDeadzone_ ?
-            controller.joyx * 0.5 * fighter_->dashSpeed_ :
+        f->xvel_ = fabs(controller.joyx) > f->inputDeadzone_ ?
+            controller.joyx * 0.5 * f->dashSpeed_ :
             0.0f;
         // If they are still "holding down" the jump button now, then full jump
         // otherwise short hop
-        if (controller.jumpbutton || controller.joyy > fighter_->inputJumpThresh_)
-            fighter_->yvel_ = fighter_->jumpSpeed_;
+        if (controller.jumpbutton || controller.joyy > f->inputJumpThresh_)
+            f->yvel_ = f->jumpSpeed_;
         else
-            fighter_->yvel_ = fighter_->hopSpeed_;
+            f->yvel_ = f->hopSpeed_;
     }
     else if (controller.pressjump ||
-            (controller.joyy > fighter_->inputJumpThresh_
-             && controller.joyyv > fighter_->inputVelocityThresh_))
+            (controller.joyy > f->inputJumpThresh_
+             && controller.joyyv > f->inputVelocityThresh_))
     {
         // Start the jump timer
         jumpTime_ = 0.0f;
@@ -477,109 +778,120 @@ void GroundState::update(const Controller &controller, float dt)
         if (dashing_)
         {
             dashing_ = false;
-            fighter_->xvel_ = fighter_->dir_ * fighter_->dashSpeed_;
-            fighter_->attack_ = new Attack(fighter_->dashAttack_);
+            f->xvel_ = f->dir_ * f->dashSpeed_;
+            f->startAttack(DASH_ATTACK);
         }
         // Not dashing- use a tilt
         else
         {
             // No movement during attack
-            fighter_->xvel_ = 0; fighter_->yvel_ = 0;
+            f->xvel_ = 0; f->yvel_ = 0;
             // Get direction of stick
             glm::vec2 tiltDir = glm::normalize(glm::vec2(controller.joyx, controller.joyy));
-            if (fabs(controller.joyx) > fighter_->inputTiltThresh_ && fabs(tiltDir.x) > fabs(tiltDir.y))
+            if (fabs(controller.joyx) > f->inputTiltThresh_ && fabs(tiltDir.x) > fabs(tiltDir.y))
             {
                 // Do the L/R tilt
-                fighter_->dir_ = controller.joyx > 0 ? 1 : -1;
-                fighter_->attack_ = new Attack(fighter_->sideTiltAttack_);
+                f->dir_ = controller.joyx > 0 ? 1 : -1;
+                f->startAttack(SIDE_TILT_ATTACK);
             }
-            else if (controller.joyy < -fighter_->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
+            else if (controller.joyy < -f->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
             {
-                fighter_->attack_ = new Attack(fighter_->downTiltAttack_);
+                f->startAttack(DOWN_TILT_ATTACK);
             }
-            else if (controller.joyy > fighter_->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
+            else if (controller.joyy > f->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
             {
-                fighter_->attack_ = new Attack(fighter_->upTiltAttack_);
+                f->startAttack(UP_TILT_ATTACK);
             }
             else
             {
                 // Neutral tilt attack
-                fighter_->attack_ = new Attack(fighter_->neutralTiltAttack_);
+                f->startAttack(NEUTRAL_TILT_ATTACK);
             }
         }
-        // Set the owner of the attack
-        fighter_->attack_->setFighter(fighter_);
     }
 
 }
 
-void GroundState::render(float dt)
+void GroundState::render(Fighter *f, float dt, float alpha)
 {
-    printf("GROUND | JumpTime: %f  DashTime: %f || ",
-            jumpTime_, dashTime_);
-    fighter_->renderHelper(dt, fighter_->color_);
+    if (trace_enabled(TRACE_STATE))
+    {
+        float values[] = { jumpTime_, dashTime_ };
+        trace_record(TRACE_GROUND_STATE, f->id_, values, 2);
+    }
+    f->renderHelper(dt, alpha, f->color_);
 }
 
-void GroundState::collisionWithGround(const Rectangle &ground, bool collision)
+void GroundState::collisionWithGround(Fighter *f, const Rectangle &ground, bool collision)
 {
     if (!collision)
-        next_ = new AirNormalState(fighter_);
+        f->nextAirNormalState();
 
     // If there is a collision, we don't need to do anything, because we're
     // already in the GroundState
 }
 
-void GroundState::hitByAttack(const Fighter *attacker, const Attack *attack)
+void GroundState::hitByAttack(Fighter *f, const Hit *hits, unsigned nhits)
 {
     // Pop up a bit so that we're not overlapping the ground
-    fighter_->rect_.x += 2;
+    f->rect_.x += 2;
     // Then do the normal stuff
-    FighterState::calculateHitResult(attacker, attack);
+    f->calculateHitResult(hits, nhits);
 }
 
-//// -------------------- AIR NORMAL STATE -----------------------------
-AirNormalState::AirNormalState(Fighter *f) :
-    FighterState(f), canSecondJump_(true), jumpTime_(-1)
+unsigned GroundState::getFields(const char **names, float *values) const
 {
-    if (f->attack_)
-        f->attack_->cancel();
+    names[0] = "jumpTime";
+    values[0] = jumpTime_;
+    names[1] = "dashTime";
+    values[1] = dashTime_;
+    names[2] = "dashChangeTime";
+    values[2] = dashChangeTime_;
+    names[3] = "dashing";
+    values[3] = dashing_;
+    return 4;
 }
 
-AirNormalState::~AirNormalState()
-{ /* Empty */ }
+//// -------------------- AIR NORMAL STATE -----------------------------
+void AirNormalState::enter(Fighter *f)
+{
+    canSecondJump_ = true;
+    jumpTime_ = -1;
+    f->cancelAttack();
+}
 
-void AirNormalState::update(const Controller &controller, float dt)
+void AirNormalState::update(Fighter *f, const Controller &controller, float dt)
 {
     // Gravity
-    fighter_->yvel_ += fighter_->airAccel_ * dt;
+    f->yvel_ += f->airAccel_ * dt;
 
     // Update running timers
     if (jumpTime_ >= 0) jumpTime_ += dt;
     // If the fighter is currently attacking, do nothing else
-    if (fighter_->attack_) return;
+    if (f->isAttacking()) return;
 
     // Let them control the character slightly
-    if (fabs(controller.joyx) > fighter_->inputDeadzone_)
+    if (fabs(controller.joyx) > f->inputDeadzone_)
     {
         // Don't let the player increase the velocity past a certain speed
-        if (fighter_->xvel_ * controller.joyx <= 0 || fabs(fighter_->xvel_) < fighter_->jumpAirSpeed_)
-            fighter_->xvel_ += controller.joyx * fighter_->airForce_ * dt;
+        if (f->xvel_ * controller.joyx <= 0 || fabs(f->xvel_) < f->jumpAirSpeed_)
+            f->xvel_ += controller.joyx * f->airForce_ * dt;
         // You can always control your orientation
-        fighter_->dir_ = controller.joyx < 0 ? -1 : 1;
+        f->dir_ = controller.joyx < 0 ? -1 : 1;
     }
 
     // --- Check for jump ---
-    if ((controller.pressjump || (controller.joyy > fighter_->inputJumpThresh_ && 
-                    controller.joyyv > fighter_->inputVelocityThresh_)) && canSecondJump_)
+    if ((controller.pressjump || (controller.joyy > f->inputJumpThresh_ && 
+                    controller.joyyv > f->inputVelocityThresh_)) && canSecondJump_)
     {
         canSecondJump_ = false;
         jumpTime_ = 0;
     }
-    if (jumpTime_ > fighter_->jumpStartupTime_) 
+    if (jumpTime_ > f->jumpStartupTime_) 
     {
-        fighter_->yvel_ = fighter_->secondJumpSpeed_;
-        fighter_->xvel_ = fabs(controller.joyx) > fighter_->inputDeadzone_ ?
-            fighter_->dashSpeed_ * std::max(-1.0f, std::min(1.0f, (controller.joyx - 0.2f) / 0.6f)) :
+        f->yvel_ = f->secondJumpSpeed_;
+        f->xvel_ = fabs(controller.joyx) > f->inputDeadzone_ ?
+            f->dashSpeed_ * std::max(-1.0f, std::min(1.0f, (controller.joyx - 0.2f) / 0.6f)) :
             0.0f;
         jumpTime_ = -1;
     }
@@ -588,57 +900,74 @@ void AirNormalState::update(const Controller &controller, float dt)
     {
         // Get direction of stick
         glm::vec2 tiltDir = glm::normalize(glm::vec2(controller.joyx, controller.joyy));
-        if (fabs(controller.joyx) > fighter_->inputTiltThresh_ && fabs(tiltDir.x) > fabs(tiltDir.y))
+        if (fabs(controller.joyx) > f->inputTiltThresh_ && fabs(tiltDir.x) > fabs(tiltDir.y))
         {
             // Do the L/R tilt
-            fighter_->dir_ = controller.joyx > 0 ? 1 : -1;
-            fighter_->attack_ = new Attack(fighter_->airSideAttack_);
+            f->dir_ = controller.joyx > 0 ? 1 : -1;
+            f->startAttack(AIR_SIDE_ATTACK);
         }
-        else if (controller.joyy < -fighter_->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
+        else if (controller.joyy < -f->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
         {
-            fighter_->attack_ = new Attack(fighter_->airDownAttack_);
+            f->startAttack(AIR_DOWN_ATTACK);
         }
-        else if (controller.joyy > fighter_->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
+        else if (controller.joyy > f->inputTiltThresh_ && fabs(tiltDir.x) < fabs(tiltDir.y))
         {
-            fighter_->attack_ = new Attack(fighter_->airUpAttack_);
+            f->startAttack(AIR_UP_ATTACK);
         }
         else
         {
             // Neutral tilt attack
-            fighter_->attack_ = new Attack(fighter_->airNeutralAttack_);
+            f->startAttack(AIR_NEUTRAL_ATTACK);
         }
-        // Set the owner of the attack
-        fighter_->attack_->setFighter(fighter_);
     }
 }
 
-void AirNormalState::render(float dt)
+void AirNormalState::render(Fighter *f, float dt, float alpha)
 {
-    printf("AIR NORMAL | JumpTime: %f  Can2ndJump: %d || ",
-            jumpTime_, canSecondJump_);
-    fighter_->renderHelper(dt, fighter_->color_);
+    if (trace_enabled(TRACE_STATE))
+    {
+        float values[] = { jumpTime_, float(canSecondJump_) };
+        trace_record(TRACE_AIR_NORMAL_STATE, f->id_, values, 2);
+    }
+    f->renderHelper(dt, alpha, f->color_);
 }
 
-void AirNormalState::collisionWithGround(const Rectangle &ground, bool collision)
+void AirNormalState::collisionWithGround(Fighter *f, const Rectangle &ground, bool collision)
 {
     // If no collision, we don't care
     if (!collision)
         return;
     // If we're completely below the ground, no 'real' collision
-    if (fighter_->rect_.y + fighter_->rect_.h/2 < ground.y + ground.h/2)
+    if (f->rect_.y + f->rect_.h/2 < ground.y + ground.h/2)
         return;
     // Overlap the ground by just one unit, only if some part of us is above
-    fighter_->rect_.y = ground.y + ground.h/2 + fighter_->rect_.h/2 - 1;
+    f->rect_.y = ground.y + ground.h/2 + f->rect_.h/2 - 1;
     // Transition to the ground state
-    if (next_) delete next_;
-    next_ = new GroundState(fighter_);
+    f->nextGroundState();
 }
 
-void AirNormalState::hitByAttack(const Fighter *attacker, const Attack *attack)
+void AirNormalState::hitByAttack(Fighter *f, const Hit *hits, unsigned nhits)
 {
-    FighterState::calculateHitResult(attacker, attack);
+    f->calculateHitResult(hits, nhits);
 }
 
+unsigned AirNormalState::getFields(const char **names, float *values) const
+{
+    names[0] = "canSecondJump";
+    values[0] = canSecondJump_;
+    names[1] = "jumpTime";
+    values[1] = jumpTime_;
+    return 2;
+}
+
+//// ------------------------- DEAD STATE ------------------------------
+void DeadState::enter(Fighter *f)
+{
+    f->rect_.x = HUGE_VAL;
+    f->rect_.y = HUGE_VAL;
+}
+
+
 
 // ----------------------------------------------------------------------------
 // Rectangle class methods
@@ -662,60 +991,32 @@ bool Rectangle::overlaps(const Rectangle &rhs) const
 // Attack class methods
 // ----------------------------------------------------------------------------
 
-void Attack::playSound() 
-{
-    if (sound_)
-        sound_->Play();
-}
-
-void Attack::setSound(sf::Music *m) 
-{
-    sound_ = m;
-}
-
-void Attack::setFighter(const Fighter *fighter)
-{
-    owner_ = fighter;
-}
-
-Rectangle Attack::getHitbox() const
+Rectangle Attack::getHitbox(const Rectangle &rect, float dir) const
 {
     Rectangle ret;
-    ret.x = hitbox_.x * owner_->getDirection() + owner_->getRectangle().x;
-    ret.y = hitbox_.y + owner_->getRectangle().y;
+    ret.x = hitbox_.x * dir + rect.x;
+    ret.y = hitbox_.y + rect.y;
     ret.h = hitbox_.h;
     ret.w = hitbox_.w;
     return ret;
 }
 
-bool Attack::hasHitbox() const
+bool Attack::hasHitbox(float t) const
 {
-    return (t_ > startup_) && (t_ < startup_ + duration_) && !hasHit_;
+    return (t > startup_) && (t < startup_ + duration_);
 }
 
-bool Attack::drawHitbox() const
+bool Attack::drawHitbox(float t) const
 {
-    return (t_ > startup_) && (t_ < startup_ + duration_);
+    return (t > startup_) && (t < startup_ + duration_);
 }
 
-bool Attack::isDone() const
+bool Attack::isDone(float t) const
 {
-    return (t_ > startup_ + duration_ + cooldown_);
+    return (t > startup_ + duration_ + cooldown_);
 }
 
-void Attack::update(float dt)
+float Attack::getCancelTime() const
 {
-    t_ += dt;
+    return startup_ + duration_;
 }
-
-void Attack::cancel()
-{
-    t_ = startup_ + duration_;
-}
-
-void Attack::hit()
-{
-    hasHit_ = true;
-    playSound();
-}
-
@@ -1,11 +1,13 @@
 #pragma once
-#include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <string>
-#include <SFML/Audio.hpp>
+#include <vector>
+#include <cmath>
+#include <cassert>
+#include "ParamReader.h"
 
-class ParamReader;
 class Fighter;
+class ExplosionManager;
 
 struct Controller
 {
@@ -30,96 +32,211 @@ public:
     float x, y, w, h;
 };
 
+// The effect of an attack connecting with a fighter, worked out before any
+// hits in a tick are applied
+struct Hit
+{
+    float damage;
+    float stun;
+    // Already flipped to the attacker's direction
+    glm::vec2 knockback;
+    // World space hitbox of the attack
+    Rectangle hitbox;
+};
+
+// Indices into a fighter's table of attacks
+enum AttackID
+{
+    NO_ATTACK = -1,
+    DASH_ATTACK = 0,
+    NEUTRAL_TILT_ATTACK,
+    SIDE_TILT_ATTACK,
+    DOWN_TILT_ATTACK,
+    UP_TILT_ATTACK,
+    AIR_NEUTRAL_ATTACK,
+    AIR_SIDE_ATTACK,
+    AIR_DOWN_ATTACK,
+    AIR_UP_ATTACK,
+    NUM_ATTACKS
+};
+
+// Reference data for one attack, loaded from params.  The timing queries
+// take the time since the attack started.
 class Attack
 {
 public:
-    Attack() {}
+    Attack() : sound_(-1) {}
     Attack(float startup, float duration, float cooldown, float damage, float stun,
             const glm::vec2& knockback, const Rectangle &hitbox) :
         hitbox_(hitbox),
         startup_(startup), duration_(duration), cooldown_(cooldown),
         damage_(damage), stun_(stun), knockback_(knockback),
-        hasHit_(false), t_(0.0f), owner_(NULL), sound_(NULL)
+        sound_(-1)
     {}
 
-    virtual ~Attack() {}
-
-    virtual Rectangle getHitbox() const;
-    virtual float getDamage(const Fighter *fighter) const { return damage_; }
-    virtual float getStun(const Fighter *fighter) const { return stun_; }
-    virtual glm::vec2 getKnockback(const Fighter *fighter) const { return knockback_; }
+    // Returns the world space hitbox for a fighter at rect facing dir
+    Rectangle getHitbox(const Rectangle &rect, float dir) const;
+    float getDamage() const { return damage_; }
+    float getStun() const { return stun_; }
+    const glm::vec2& getKnockback() const { return knockback_; }
 
-    void setFighter(const Fighter *fighter);
-
-    // If hitbox can hit another player
-    virtual bool hasHitbox() const;
+    // If hitbox is out at time t
+    bool hasHitbox(float t) const;
     // If hitbox should be drawn
-    virtual bool drawHitbox() const;
+    bool drawHitbox(float t) const;
     // If this attack is over
-    virtual bool isDone() const;
+    bool isDone(float t) const;
+    // The time to skip to when cancelled, the start of cooldown
+    float getCancelTime() const;
 
-    // Updates internal timer
-    virtual void update(float dt);
-    // Sends to cooldown time
-    virtual void cancel();
-    // Called when the attack 'connects'
-    virtual void hit();
-    void playSound();
-    void setSound(sf::Music *);
+    // The sound id, as returned by load_sound, played on hit
+    int getSound() const { return sound_; }
+    void setSound(int soundID) { sound_ = soundID; }
 
 private:
     Rectangle hitbox_;
     float startup_, duration_, cooldown_;
     float damage_, stun_;
     glm::vec2 knockback_;
-    bool hasHit_;
-    float t_;
+    int sound_;
+};
 
-    const Fighter *owner_;
-    sf::Music *sound_;
+// The attack a fighter is currently doing, kept inline in the Fighter
+struct ActiveAttack
+{
+    // Which of the fighter's attacks, NO_ATTACK if not attacking
+    int id;
+    // Time since the attack started
+    float t;
+    // True once the attack has connected, it can only hit once
+    bool hasHit;
 };
 
-class FighterState
+// The fighter states are plain data stored by value inside their Fighter,
+// so changing state never allocates.  Each takes the fighter it belongs to
+// as an argument and Fighter dispatches on FighterState::id.  enter() sets a
+// state up and applies any effect the transition has on the fighter.
+// getFields() gives the names and values of a state's members, so states
+// can be compared when hunting for a desync.
+
+static const unsigned MAX_STATE_FIELDS = 4;
+
+class GroundState
 {
 public:
-    FighterState(Fighter *f) :
-        fighter_(f), next_(NULL)
-    {}
-    virtual ~FighterState() {}
-
-    // Returns true if this state should transition to a new one
-    bool hasTransition() const { return next_ != NULL; }
-    // Returns the next state to transition to, only valid if needsTransition()
-    // returns true.
-    FighterState* nextState() const { return next_; }
-
-    // State behavior functions
-    // This function is called once every call to Fighter::update
-    virtual void update(const Controller&, float dt) = 0;
-    // TODO description
-    virtual void render(float dt) = 0;
-    // This function is called once every call to Fighter::collisionWithGround
-    virtual void collisionWithGround(const Rectangle &ground, bool collision) = 0;
-    // This function is called when Fighter::hitByAttack is called, before any
-    // other work is done
-    virtual void hitByAttack(const Fighter *attacker, const Attack *attack) = 0;
-
-protected:
-    Fighter *fighter_;
-    FighterState *next_;
-
-    void calculateHitResult(const Fighter *fighter, const Attack *attack);
+    void enter(Fighter *f);
+    void update(Fighter *f, const Controller&, float dt);
+    void render(Fighter *f, float dt, float alpha);
+    void collisionWithGround(Fighter *f, const Rectangle &ground, bool collision);
+    void hitByAttack(Fighter *f, const Hit *hits, unsigned nhits);
+    unsigned getFields(const char **names, float *values) const;
+
+private:
+    // Jump startup timer.  Value >= 0 implies that the fighter is starting a jump
+    float jumpTime_;
+    // Dash startup timer.  Value >= 0 implies that the fighter is start to dash
+    float dashTime_;
+    // Dash change direction timer
+    float dashChangeTime_;
+    bool dashing_;
+};
+
+class AirNormalState
+{
+public:
+    void enter(Fighter *f);
+    void update(Fighter *f, const Controller&, float dt);
+    void render(Fighter *f, float dt, float alpha);
+    void collisionWithGround(Fighter *f, const Rectangle &ground, bool collision);
+    void hitByAttack(Fighter *f, const Hit *hits, unsigned nhits);
+    unsigned getFields(const char **names, float *values) const;
+
+private:
+    // True if the player has a second jump available
+    bool canSecondJump_;
+    // Jump startup timer.  Value > 0 implies that the fighter is starting a jump
+    float jumpTime_;
+};
+
+class AirStunnedState
+{
+public:
+    void enter(Fighter *f, float duration);
+    void update(Fighter *f, const Controller&, float dt);
+    void render(Fighter *f, float dt, float alpha);
+    void collisionWithGround(Fighter *f, const Rectangle &ground, bool collision);
+    void hitByAttack(Fighter *f, const Hit *hits, unsigned nhits);
+    unsigned getFields(const char **names, float *values) const;
+
+private:
+    float stunDuration_;
+    float stunTime_;
+};
+
+// Out of lives, has no data and does nothing
+class DeadState
+{
+public:
+    void enter(Fighter *f);
+};
+
+enum FighterStateID
+{
+    GROUND_STATE,
+    AIR_NORMAL_STATE,
+    AIR_STUNNED_STATE,
+    DEAD_STATE
+};
+
+// Tagged union of the states above.  Always memset to zero before a state is
+// entered, so the bytes the state doesn't use are the same every time and
+// the whole thing can be hashed.
+struct FighterState
+{
+    FighterStateID id;
+    union
+    {
+        GroundState ground;
+        AirNormalState airNormal;
+        AirStunnedState airStunned;
+        DeadState dead;
+    };
+};
+
+// Everything about a fighter that changes during a match, as plain data.
+// What comes from params, and the fighter's color and respawn point, are
+// fixed when the fighter is made and aren't included.
+struct FighterSnapshot
+{
+    Rectangle rect, lastRect;
+    float xvel, yvel, dir;
+    float damage;
+    int lives;
+    FighterState state, next;
+    int hasNext;
+    // The ActiveAttack, spelled out so there are no padding bytes
+    int attackID;
+    float attackT;
+    int attackHasHit;
+
+    // Adds a "field: this vs other" line to diffs for each field that
+    // differs, down to the members of the states
+    void diff(const FighterSnapshot &other, std::vector<std::string> &diffs) const;
 };
 
 
 class Fighter
 {
 public:
-    Fighter(const ParamReader &params, float respawnx, float respawny, const glm::vec3 &color);
+    // Explosions and puffs the fighter makes are added to explosions.  id is
+    // the player number, used to tell fighters apart in traces.
+    Fighter(const ParamReader &params, float respawnx, float respawny,
+            const glm::vec3 &color, ExplosionManager *explosions, int id);
     ~Fighter();
 
     void update(const Controller&, float dt);
-    void render(float dt);
+    // alpha in [0, 1] interpolates between the last two updated positions
+    void render(float dt, float alpha);
 
     int getLives() const;
     float getDamage() const;
@@ -128,152 +245,111 @@ public:
     // collision is true if there is a collision with ground this frame, false otherwise
     void collisionWithGround(const Rectangle &ground, bool collision);
     void attackCollision(); // Called when two attacks collide
-    void hitByAttack(const Fighter *fighter, const Attack* attack);  // Called when hit by an attack
+    // Called with every attack that hit this fighter in a tick
+    void hitByAttack(const Hit *hits, unsigned nhits);
     void hitWithAttack(); // Called when you hit with an attack
     // Gets the fighter's hitbox
     const Rectangle& getRectangle() const;
 
     // Returns true if this Fighter is currently attacking and has an attack hitbox
     bool hasAttack() const;
-    const Attack * getAttack() const;
+    // World space hitbox of the current attack, only valid if hasAttack()
+    Rectangle getAttackHitbox() const;
+    // The result of the current attack hitting target, only valid if
+    // hasAttack()
+    Hit getAttackHit(const Fighter *target) const;
+
+    // Takes new stats and attacks from params while the fighter is in play.
+    // changed has NUM_PARAMS entries, only attacks with a changed param are
+    // rebuilt, and any attack in progress carries on with its new values.
+    void reloadParams(const ParamReader &params, const bool *changed);
+
+    // Adds every sound file a fighter plays to files, without repeats, so
+    // they can be loaded before any fighter is made
+    static void getSoundFiles(std::vector<const char *> &files);
 
     // Respawns the fighter at its respawn location.  If killed is true, a
     // life be removed
     void respawn(bool killed);
+
+    void save(FighterSnapshot &snapshot) const;
+    // Puts the fighter back exactly as it was when snapshot was saved
+    void restore(const FighterSnapshot &snapshot);
     // True if this player has more than 0 lives
     bool isAlive() const;
 
 private:
     // Game state members
     Rectangle rect_;
+    Rectangle lastRect_; // rect_ before the last update, for interpolation
     float xvel_, yvel_;
     float dir_; // 1 or -1 look in xdir
-    FighterState *state_;
+    FighterState state_;
+    // The state to switch to at the start of the next update, only valid if
+    // hasNext_ is true
+    FighterState next_;
+    bool hasNext_;
     float damage_;
     int lives_;
 
     // Fighter ID members
+    int id_;
     float respawnx_, respawny_;
     glm::vec3 color_;
+    ExplosionManager *explosions_;
+    int koSound_;
 
     // Current attack members
-    Attack* attack_;
-
-    // Available reference attacks
-    Attack dashAttack_;
-    Attack neutralTiltAttack_;
-    Attack sideTiltAttack_;
-    Attack downTiltAttack_;
-    Attack upTiltAttack_;
+    ActiveAttack attack_;
 
-    Attack airNeutralAttack_;
-    Attack airSideAttack_;
-    Attack airDownAttack_;
-    Attack airUpAttack_;
+    // Available reference attacks, indexed by AttackID
+    Attack attacks_[NUM_ATTACKS];
 
     // Fighter stats
-    const float walkSpeed_; // maximum walking speed
-    const float dashSpeed_; // Dashing Speed
-    const float jumpStartupTime_; // Delay before jump begins, also short hop/full jump control time
-    const float dashStartupTime_; // Time from starting dash to first movement
-    const float jumpSpeed_; // Speed of a full jump
-    const float hopSpeed_; // Speed of a short hop
-
-    const float airForce_; // Force applied to allow player air control
-    const float airAccel_; // "Gravity"
-    const float jumpAirSpeed_; // The maximum x speed for jumping (only for player control)
-    const float secondJumpSpeed_; // Speed of the second jump
+    float walkSpeed_; // maximum walking speed
+    float dashSpeed_; // Dashing Speed
+    float jumpStartupTime_; // Delay before jump begins, also short hop/full jump control time
+    float dashStartupTime_; // Time from starting dash to first movement
+    float jumpSpeed_; // Speed of a full jump
+    float hopSpeed_; // Speed of a short hop
+
+    float airForce_; // Force applied to allow player air control
+    float airAccel_; // "Gravity"
+    float jumpAirSpeed_; // The maximum x speed for jumping (only for player control)
+    float secondJumpSpeed_; // Speed of the second jump
 
     // Input response parameters
-    const float inputVelocityThresh_;
-    const float inputJumpThresh_;
-    const float inputDashThresh_;
-    const float inputDashMin_;
-    const float inputDeadzone_;
-    const float inputTiltThresh_;
+    float inputVelocityThresh_;
+    float inputJumpThresh_;
+    float inputDashThresh_;
+    float inputDashMin_;
+    float inputDeadzone_;
+    float inputTiltThresh_;
 
     // ---- Helper functions ----
     float damageFunc() const; // Returns a scaling factor based on damage
-    // Loads an attack from the params using the attackName.param syntax
-    Attack loadAttack(const ParamReader &params, std::string attackName,
-            std::string soundFile = "");
-    void renderHelper(float dt, const glm::vec3& color);
+    // Loads an attack from the block of params starting at block
+    Attack loadAttack(const ParamReader &params, ParamID block,
+            const char *soundFile = NULL);
+    void loadStats(const ParamReader &params);
+    void renderHelper(float dt, float alpha, const glm::vec3& color);
+
+    bool isAttacking() const;
+    void startAttack(AttackID id);
+    // Sends the current attack to its cooldown
+    void cancelAttack();
+    // Stops attacking altogether
+    void endAttack();
+
+    // Queue a transition to another state, the new state is entered now
+    void nextGroundState();
+    void nextAirNormalState();
+    void nextAirStunnedState(float duration);
+    // Shared by the states that can be hit
+    void calculateHitResult(const Hit *hits, unsigned nhits);
 
-    friend class FighterState;
     friend class GroundState;
-    friend class DashState;
     friend class AirNormalState;
     friend class AirStunnedState;
     friend class DeadState;
 };
-
-class GroundState : public FighterState
-{
-public:
-    GroundState(Fighter *f);
-    virtual ~GroundState();
-
-    virtual void update(const Controller&, float dt);
-    virtual void render(float dt);
-    virtual void collisionWithGround(const Rectangle &ground, bool collision);
-    virtual void hitByAttack(const Fighter *attacker, const Attack *attack);
-
-private:
-    // Jump startup timer.  Value >= 0 implies that the fighter is starting a jump
-    float jumpTime_;
-    // Dash startup timer.  Value >= 0 implies that the fighter is start to dash
-    float dashTime_;
-    // Dash change direction timer
-    float dashChangeTime_;
-    bool dashing_;
-};
-
-class AirNormalState : public FighterState
-{
-public:
-    AirNormalState(Fighter *f);
-    virtual ~AirNormalState();
-
-    virtual void update(const Controller&, float dt);
-    virtual void render(float dt);
-    virtual void collisionWithGround(const Rectangle &ground, bool collision);
-    virtual void hitByAttack(const Fighter *attacker, const Attack *attack);
-
-private:
-    // True if the player has a second jump available
-    bool canSecondJump_;
-    // Jump startup timer.  Value > 0 implies that the fighter is starting a jump
-    float jumpTime_;
-};
-
-class AirStunnedState : public FighterState
-{
-public:
-    AirStunnedState(Fighter *f, float duration);
-    virtual ~AirStunnedState();
-
-    virtual void update(const Controller&, float dt);
-    virtual void render(float dt);
-    virtual void collisionWithGround(const Rectangle &ground, bool collision);
-    virtual void hitByAttack(const Fighter *attacker, const Attack *attack);
-
-private:
-    float stunDuration_;
-    float stunTime_;
-};
-
-class DeadState : public FighterState
-{
-public:
-    DeadState(Fighter *f) : FighterState(f)
-    {
-        f->rect_.x = HUGE_VAL;
-        f->rect_.y = HUGE_VAL;
-    };
-    virtual ~DeadState() {};
-
-    virtual void update(const Controller&, float dt) { }
-    virtual void render(float dt) { }
-    virtual void collisionWithGround(const Rectangle &ground, bool collision) { assert(false); }
-    virtual void hitByAttack(const Fighter *attacker, const Attack *attack) { assert(false); }
-};
@@ -0,0 +1,252 @@
+#include "ParamReader.h"
+#include "archive.h"
+#include "hash.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char *paramNames[] =
+{
+#define PARAM(id, key) key,
+#define ATTACK_PARAMS(id, key) key ".startup", key ".duration", key ".cooldown", \
+    key ".damage", key ".stun", key ".knockbackx", key ".knockbacky", \
+    key ".knockbackpow", key ".hitboxx", key ".hitboxy", key ".hitboxw", \
+    key ".hitboxh",
+#include "params.def"
+#undef PARAM
+#undef ATTACK_PARAMS
+};
+// Fails to compile if the names and ParamID get out of step
+typedef char paramNamesCheck[
+    sizeof(paramNames) / sizeof(paramNames[0]) == NUM_PARAMS ? 1 : -1];
+
+// Binary cache of a params file, written next to it and read back in a
+// single read.  Only used when the schema and the source file's size and
+// modification time match.
+static const char PARAM_CACHE_MAGIC[4] = { 'G', 'S', 'P', 'C' };
+static const uint32_t PARAM_CACHE_VERSION = 1;
+
+struct ParamCache
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t numParams;
+    uint32_t pad;
+    uint64_t schemaHash;
+    int64_t sourceSize;
+    int64_t sourceMtime; // nanoseconds
+    float values[NUM_PARAMS];
+};
+
+static uint64_t schemaHash()
+{
+    uint64_t h = HASH_SEED;
+    for (unsigned i = 0; i < NUM_PARAMS; i++)
+        h = hash_bytes(paramNames[i], strlen(paramNames[i]), h);
+    return h;
+}
+
+struct NameOrder
+{
+    bool operator()(unsigned a, unsigned b) const
+    {
+        return strcmp(paramNames[a], paramNames[b]) < 0;
+    }
+};
+
+// Slots sorted by key, hash() walks them in this order
+struct SortedParams
+{
+    SortedParams()
+    {
+        for (unsigned i = 0; i < NUM_PARAMS; i++)
+            order[i] = i;
+        std::sort(order, order + NUM_PARAMS, NameOrder());
+    }
+    unsigned order[NUM_PARAMS];
+};
+
+static bool statSource(const char *filename, int64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return false;
+    size = st.st_size;
+    mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+ParamReader::ParamReader() :
+    valid_(false)
+{
+    memset(values_, 0, sizeof(values_));
+}
+
+ParamReader::ParamReader(const char *filename) :
+    valid_(false)
+{
+    memset(values_, 0, sizeof(values_));
+
+    // Packed params are already in memory, so there's nothing to cache
+    size_t size;
+    const char *packed = (const char *) find_asset(filename, &size);
+    if (packed)
+    {
+        valid_ = parse(packed, size, filename);
+        return;
+    }
+
+    std::string cachename = std::string(filename) + ".cache";
+    if (readCache(cachename, filename))
+    {
+        valid_ = true;
+        return;
+    }
+
+    valid_ = readFile(filename);
+    if (valid_)
+        writeCache(cachename, filename);
+}
+
+int ParamReader::find(const std::string &key)
+{
+    for (unsigned i = 0; i < NUM_PARAMS; i++)
+        if (key == paramNames[i])
+            return i;
+    return -1;
+}
+
+const char * ParamReader::getName(ParamID id)
+{
+    return paramNames[id];
+}
+
+uint64_t ParamReader::hash() const
+{
+    // Sorted by key, so the hash doesn't depend on the schema's order
+    static const SortedParams sorted;
+    uint64_t h = HASH_SEED;
+    for (unsigned i = 0; i < NUM_PARAMS; i++)
+    {
+        unsigned slot = sorted.order[i];
+        h = hash_bytes(paramNames[slot], strlen(paramNames[slot]), h);
+        h = hash_bytes(&values_[slot], sizeof(float), h);
+    }
+    return h;
+}
+
+bool ParamReader::readFile(const char *filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "UNABLE TO OPEN " << filename << " to read params\n";
+        return false;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    const std::string &text = contents.str();
+    return parse(text.data(), text.size(), filename);
+}
+
+bool ParamReader::parse(const char *text, size_t size, const char *filename)
+{
+    bool found[NUM_PARAMS];
+    memset(found, 0, sizeof(found));
+
+    std::string key;
+    float val;
+
+    const char *end = text + size;
+    while (text < end)
+    {
+        const char *eol = (const char *) memchr(text, '\n', end - text);
+        if (!eol)
+            eol = end;
+        std::stringstream ss(std::string(text, eol));
+        text = eol + 1;
+
+        ss >> key >> val;
+        if (ss.fail())
+            continue;
+        int slot = find(key);
+        if (slot < 0)
+        {
+            std::cerr << "WARNING: unknown param " << key << " in " << filename << '\n';
+            continue;
+        }
+        values_[slot] = val;
+        found[slot] = true;
+    }
+
+    bool ok = true;
+    for (unsigned i = 0; i < NUM_PARAMS; i++)
+    {
+        if (!found[i])
+        {
+            std::cerr << "ERROR: param " << paramNames[i] << " missing from "
+                << filename << '\n';
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool ParamReader::readCache(const std::string &cachename, const char *filename)
+{
+    int64_t size, mtime;
+    if (!statSource(filename, size, mtime))
+        return false;
+
+    int fd = open(cachename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    ParamCache cache;
+    ssize_t n = read(fd, &cache, sizeof(cache));
+    ::close(fd);
+
+    if (n != (ssize_t) sizeof(cache)
+            || memcmp(cache.magic, PARAM_CACHE_MAGIC, sizeof(cache.magic))
+            || cache.version != PARAM_CACHE_VERSION
+            || cache.numParams != NUM_PARAMS
+            || cache.schemaHash != schemaHash()
+            || cache.sourceSize != size || cache.sourceMtime != mtime)
+        return false;
+    for (unsigned i = 0; i < NUM_PARAMS; i++)
+        if (!std::isfinite(cache.values[i]))
+            return false;
+
+    memcpy(values_, cache.values, sizeof(values_));
+    return true;
+}
+
+void ParamReader::writeCache(const std::string &cachename, const char *filename) const
+{
+    ParamCache cache;
+    memset(&cache, 0, sizeof(cache));
+    if (!statSource(filename, cache.sourceSize, cache.sourceMtime))
+        return;
+    memcpy(cache.magic, PARAM_CACHE_MAGIC, sizeof(cache.magic));
+    cache.version = PARAM_CACHE_VERSION;
+    cache.numParams = NUM_PARAMS;
+    cache.schemaHash = schemaHash();
+    memcpy(cache.values, values_, sizeof(values_));
+
+    // Write somewhere private and rename, so a reader never sees half a file
+    std::stringstream tmpname;
+    tmpname << cachename << '.' << getpid();
+    FILE *file = fopen(tmpname.str().c_str(), "wb");
+    if (!file)
+        return;
+    bool ok = fwrite(&cache, sizeof(cache), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpname.str().c_str(), cachename.c_str()) != 0)
+        remove(tmpname.str().c_str());
+}
@@ -1,60 +1,73 @@
 #pragma once
-#include <map>
-#include <iostream>
-#include <fstream>
-#include <sstream>
+#include <string>
+#include <stdint.h>
 
+// Offsets of each value in a block of attack params
+enum AttackParamID
+{
+    ATTACK_STARTUP,
+    ATTACK_DURATION,
+    ATTACK_COOLDOWN,
+    ATTACK_DAMAGE,
+    ATTACK_STUN,
+    ATTACK_KNOCKBACKX,
+    ATTACK_KNOCKBACKY,
+    ATTACK_KNOCKBACKPOW,
+    ATTACK_HITBOXX,
+    ATTACK_HITBOXY,
+    ATTACK_HITBOXW,
+    ATTACK_HITBOXH,
+    NUM_ATTACK_PARAMS
+};
+
+// Slot of every param in the schema, see params.def.  An attack block's id
+// is its first slot, add an AttackParamID to get the rest.
+enum ParamID
+{
+#define PARAM(id, key) id,
+#define ATTACK_PARAMS(id, key) id, id##_END = id + NUM_ATTACK_PARAMS - 1,
+#include "params.def"
+#undef PARAM
+#undef ATTACK_PARAMS
+    NUM_PARAMS
+};
+
+// Param values stored flat by ParamID.  Keys are only looked at when the file
+// is read, get() is just an array index.
 class ParamReader
 {
 public:
-    ParamReader() {}
-    ParamReader(const char *filename)
-    {
-        readFile(filename);
-    }
+    ParamReader();
+    // Loads filename, from the asset archive if it is packed, otherwise from
+    // its binary cache if that is up to date.  Check
+    // isValid() afterwards, every error has already been printed.
+    explicit ParamReader(const char *filename);
 
-    float get(const std::string &key) const
+    // False if the file couldn't be read or didn't set every param
+    bool isValid() const { return valid_; }
+
+    float get(ParamID id) const { return values_[id]; }
+    float get(ParamID block, AttackParamID offset) const
     {
-        std::map<std::string, float>::const_iterator it = params_.find(key);
-        if (it == params_.end())
-            assert(false && "Key not found in params");
-        else
-            return it->second;
+        return values_[block + offset];
     }
+    void set(ParamID id, float value) { values_[id] = value; }
 
-private:
-    std::map<std::string, float> params_;
+    // Returns the slot for key, or -1 if it isn't in the schema
+    static int find(const std::string &key);
+    static const char * getName(ParamID id);
 
-    void readFile(const char *filename)
-    {
-        std::ifstream file(filename);
-        if (!file)
-        {
-            std::cerr << "UNABLE TO OPEN " << filename << " to read params\n";
-            return;
-        }
-
-        std::string key;
-        float val;
-
-        std::string line;
-        while (std::getline(file, line))
-        {
-            std::stringstream ss(line);
-            ss >> key >> val;
-            if (ss.fail())
-                continue;
-            params_[key] = val;
-        }
-    }
+    // Returns a 64 bit hash of every key and value, for checking that
+    // two sets of params are the same
+    uint64_t hash() const;
 
-    void printParams() const
-    {
-        std::cout << "Params:\n";
-        std::map<std::string, float>::const_iterator it;
-        for (it = params_.begin(); it != params_.end(); it++)
-        {
-            std::cout << it->first << ' ' << it->second << '\n';
-        }
-    }
+private:
+    float values_[NUM_PARAMS];
+    bool valid_;
+
+    bool readFile(const char *filename);
+    // Reads params from the text of a params file
+    bool parse(const char *text, size_t size, const char *filename);
+    bool readCache(const std::string &cachename, const char *filename);
+    void writeCache(const std::string &cachename, const char *filename) const;
 };
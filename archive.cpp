@@ -0,0 +1,220 @@
+#include "archive.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char ARCHIVE_MAGIC[4] = { 'G', 'S', 'P', 'K' };
+static const uint32_t ARCHIVE_VERSION = 1;
+
+static AssetArchive assetArchive;
+
+// ----------------------------------------------------------------------------
+// AssetArchive class methods
+// ----------------------------------------------------------------------------
+
+AssetArchive::AssetArchive() :
+    data_(NULL), size_(0), entries_(NULL), numEntries_(0)
+{}
+
+AssetArchive::~AssetArchive()
+{
+    close();
+}
+
+bool AssetArchive::open(const char *filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(ArchiveHeader))
+    {
+        std::cerr << filename << " is not an asset archive\n";
+        ::close(fd);
+        return false;
+    }
+    // Shared, so every process using the archive uses the same pages
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "Unable to map asset archive " << filename << '\n';
+        return false;
+    }
+    data_ = (const unsigned char *) data;
+    size_ = st.st_size;
+
+    ArchiveHeader header;
+    memcpy(&header, data_, sizeof(header));
+    bool ok = memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) == 0
+        && header.version == ARCHIVE_VERSION
+        && header.numEntries <= (size_ - sizeof(header)) / sizeof(ArchiveEntry);
+    entries_ = (const ArchiveEntry *) (data_ + sizeof(header));
+    numEntries_ = ok ? header.numEntries : 0;
+    for (unsigned i = 0; ok && i < numEntries_; i++)
+    {
+        const ArchiveEntry &entry = entries_[i];
+        ok = memchr(entry.name, '\0', ARCHIVE_NAME_SIZE) != NULL
+            && entry.offset <= size_ && entry.size <= size_ - entry.offset
+            && (i == 0 || strcmp(entries_[i - 1].name, entry.name) < 0);
+    }
+    if (!ok)
+    {
+        std::cerr << filename << " is not a valid asset archive\n";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void AssetArchive::close()
+{
+    if (data_)
+        munmap((void *) data_, size_);
+    data_ = NULL;
+    size_ = 0;
+    entries_ = NULL;
+    numEntries_ = 0;
+}
+
+bool AssetArchive::isOpen() const
+{
+    return data_ != NULL;
+}
+
+const void * AssetArchive::find(const char *name, size_t *size) const
+{
+    // Binary search, the entries are sorted by name
+    unsigned lo = 0, hi = numEntries_;
+    while (lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        int cmp = strcmp(entries_[mid].name, name);
+        if (cmp == 0)
+        {
+            *size = entries_[mid].size;
+            return data_ + entries_[mid].offset;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+struct EntryOrder
+{
+    bool operator()(const ArchiveEntry &a, const ArchiveEntry &b) const
+    {
+        return strcmp(a.name, b.name) < 0;
+    }
+};
+
+bool AssetArchive::pack(const char *filename, const char * const *files,
+        unsigned nfiles)
+{
+    // Read everything first, so nothing is written if an input is bad
+    std::vector<ArchiveEntry> entries(nfiles);
+    std::vector<std::string> contents(nfiles);
+    for (unsigned i = 0; i < nfiles; i++)
+    {
+        if (strlen(files[i]) >= ARCHIVE_NAME_SIZE)
+        {
+            std::cerr << "Asset path too long to pack: " << files[i] << '\n';
+            return false;
+        }
+        FILE *in = fopen(files[i], "rb");
+        if (!in)
+        {
+            std::cerr << "Unable to open " << files[i] << " to pack\n";
+            return false;
+        }
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+            contents[i].append(buf, n);
+        fclose(in);
+
+        memset(&entries[i], 0, sizeof(ArchiveEntry));
+        strcpy(entries[i].name, files[i]);
+        // Stash the input index until the entries are sorted
+        entries[i].offset = i;
+        entries[i].size = contents[i].size();
+    }
+    std::sort(entries.begin(), entries.end(), EntryOrder());
+    for (unsigned i = 1; i < nfiles; i++)
+    {
+        if (strcmp(entries[i - 1].name, entries[i].name) == 0)
+        {
+            std::cerr << entries[i].name << " is packed twice\n";
+            return false;
+        }
+    }
+
+    // Lay out the contents after the table
+    std::vector<unsigned> order(nfiles);
+    uint64_t offset = sizeof(ArchiveHeader) + nfiles * sizeof(ArchiveEntry);
+    for (unsigned i = 0; i < nfiles; i++)
+    {
+        order[i] = entries[i].offset;
+        offset = (offset + ARCHIVE_ALIGN - 1) / ARCHIVE_ALIGN * ARCHIVE_ALIGN;
+        entries[i].offset = offset;
+        offset += entries[i].size;
+    }
+
+    FILE *out = fopen(filename, "wb");
+    if (!out)
+    {
+        std::cerr << "Unable to open " << filename << " to write archive\n";
+        return false;
+    }
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.numEntries = nfiles;
+    fwrite(&header, sizeof(header), 1, out);
+    if (nfiles)
+        fwrite(&entries[0], sizeof(ArchiveEntry), nfiles, out);
+    for (unsigned i = 0; i < nfiles; i++)
+    {
+        static const char zeros[ARCHIVE_ALIGN] = { 0 };
+        long pad = entries[i].offset - ftell(out);
+        fwrite(zeros, 1, pad, out);
+        const std::string &data = contents[order[i]];
+        fwrite(data.data(), 1, data.size(), out);
+    }
+    if (ferror(out) | fclose(out))
+    {
+        std::cerr << "Error writing archive " << filename << '\n';
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Global archive
+// ----------------------------------------------------------------------------
+
+bool open_asset_archive(const char *filename)
+{
+    return assetArchive.open(filename);
+}
+
+const void * find_asset(const char *name, size_t *size)
+{
+    if (!assetArchive.isOpen())
+        return NULL;
+    return assetArchive.find(name, size);
+}
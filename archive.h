@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * A packed asset archive: a header, a table of entries sorted by name, then
+ * the file contents.  It is mapped read only, so lookups hand out pointers
+ * straight into the mapping and processes loading the same archive share
+ * its pages.  ssb-pack builds one.
+ */
+
+struct ArchiveHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t pad;
+};
+
+static const size_t ARCHIVE_NAME_SIZE = 48;
+// Contents start on multiples of this
+static const size_t ARCHIVE_ALIGN = 16;
+
+struct ArchiveEntry
+{
+    // NUL terminated path the file was packed as
+    char name[ARCHIVE_NAME_SIZE];
+    uint64_t offset;
+    uint64_t size;
+};
+
+class AssetArchive
+{
+public:
+    AssetArchive();
+    ~AssetArchive();
+
+    // Maps filename, returns false if it is missing or malformed
+    bool open(const char *filename);
+    void close();
+    bool isOpen() const;
+
+    // Returns the contents of name, or NULL if it isn't in the archive.  The
+    // pointer is valid until the archive is closed.
+    const void * find(const char *name, size_t *size) const;
+
+    // Writes an archive of files to filename, each packed under its path
+    static bool pack(const char *filename, const char * const *files,
+            unsigned nfiles);
+
+private:
+    const unsigned char *data_;
+    size_t size_;
+    const ArchiveEntry *entries_;
+    unsigned numEntries_;
+
+    AssetArchive(const AssetArchive &);
+};
+
+// The archive every loader checks before the file system.  Returns false if
+// filename doesn't exist or isn't a valid archive.
+bool open_asset_archive(const char *filename);
+// Looks name up in the archive opened by open_asset_archive, NULL if there
+// isn't one or it doesn't have name
+const void * find_asset(const char *name, size_t *size);
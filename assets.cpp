@@ -0,0 +1,202 @@
+#include "assets.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "glutils.h"
+#include "util.h"
+#include "audio.h"
+#include "timer.h"
+#include "archive.h"
+
+static const char *assetTypeNames[] = { "shader", "program", "texture", "sound" };
+
+AssetLoader::Asset::Asset(AssetLoader *l, AssetType t, const char *file) :
+    loader(l), type(t), filename(file), object(NULL), shaderType(0),
+    data(NULL), view(NULL), size(0), data2(NULL), view2(NULL), size2(0), width(0), height(0),
+    sound(NULL), ok(false), decodeTime(0), uploadTime(0)
+{}
+
+AssetLoader::Asset::~Asset()
+{
+    free(data);
+    free(data2);
+    free_decoded_sound(sound);
+}
+
+void AssetLoader::Asset::readFile(const std::string &filename, void *&data,
+        const void *&view, int &size)
+{
+    // Use the archive's pages directly, no copy
+    size_t packedSize;
+    view = find_asset(filename.c_str(), &packedSize);
+    if (view)
+    {
+        size = packedSize;
+        return;
+    }
+    data = file_contents(filename.c_str(), &size);
+    view = data;
+}
+
+void AssetLoader::Asset::run()
+{
+    double start = get_time();
+    size_t packedSize;
+    const void *packed = find_asset(filename.c_str(), &packedSize);
+    if (type != TEXTURE_ASSET)
+        readFile(filename, data, view, size);
+    else if (packed)
+        view = parse_tga(packed, packedSize, filename.c_str(), &width, &height);
+    else
+        view = data = read_tga(filename.c_str(), &width, &height);
+    if (type == PROGRAM_ASSET)
+        readFile(filename2, data2, view2, size2);
+    // Decoding sounds is the slow part, so it happens here and not in upload
+    if (type == SOUND_ASSET && view)
+    {
+        sound = decode_sound(filename.c_str(), view, size);
+        free(data);
+        data = NULL;
+        view = NULL;
+    }
+    decodeTime = get_time() - start;
+
+    std::lock_guard<std::mutex> guard(loader->lock_);
+    loader->decoded_.push_back(this);
+    loader->assetDecoded_.notify_one();
+}
+
+void AssetLoader::Asset::upload()
+{
+    double start = get_time();
+    if (type == SOUND_ASSET)
+    {
+        ok = add_decoded_sound(filename.c_str(), sound) >= 0;
+        sound = NULL;
+    }
+    else if (view && (type != PROGRAM_ASSET || view2))
+    {
+        switch (type)
+        {
+        case PROGRAM_ASSET:
+            *object = make_program_source((const char *)view, size,
+                    (const char *)view2, size2, filename.c_str());
+            ok = *object != 0;
+            break;
+        case SHADER_ASSET:
+            *object = make_shader_source(shaderType, (const char *)view, size,
+                    filename.c_str());
+            ok = *object != 0;
+            break;
+        case TEXTURE_ASSET:
+            *object = make_texture_pixels(view, width, height);
+            ok = *object != 0;
+            break;
+        case SOUND_ASSET:
+            // Handled above
+            break;
+        }
+    }
+    free(data);
+    free(data2);
+    data = data2 = NULL;
+    view = view2 = NULL;
+    uploadTime = get_time() - start;
+}
+
+AssetLoader::AssetLoader(ThreadPool *pool) :
+    pool_(pool), uploaded_(0), start_(0), end_(0)
+{}
+
+AssetLoader::~AssetLoader()
+{
+    // Tasks can't be freed while the pool might still run them
+    pool_->wait();
+    for (unsigned i = 0; i < assets_.size(); i++)
+        delete assets_[i];
+}
+
+AssetLoader::Asset* AssetLoader::queue(AssetType type, const char *filename)
+{
+    if (assets_.empty())
+        start_ = get_time();
+    Asset *asset = new Asset(this, type, filename);
+    assets_.push_back(asset);
+    return asset;
+}
+
+void AssetLoader::loadShader(GLuint *shader, GLenum type, const char *filename)
+{
+    Asset *asset = queue(SHADER_ASSET, filename);
+    asset->object = shader;
+    asset->shaderType = type;
+    pool_->submit(asset);
+}
+
+void AssetLoader::loadProgram(GLuint *program, const char *vertexFile,
+        const char *fragmentFile)
+{
+    Asset *asset = queue(PROGRAM_ASSET, vertexFile);
+    asset->object = program;
+    asset->filename2 = fragmentFile;
+    pool_->submit(asset);
+}
+
+void AssetLoader::loadTexture(GLuint *texture, const char *filename)
+{
+    Asset *asset = queue(TEXTURE_ASSET, filename);
+    asset->object = texture;
+    pool_->submit(asset);
+}
+
+void AssetLoader::loadSound(const char *filename)
+{
+    pool_->submit(queue(SOUND_ASSET, filename));
+}
+
+bool AssetLoader::finish()
+{
+    bool ok = true;
+    std::vector<Asset*> ready;
+    while (uploaded_ < assets_.size())
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            while (decoded_.empty())
+                assetDecoded_.wait(guard);
+            ready.swap(decoded_);
+        }
+        // Upload outside the lock so decoding carries on meanwhile
+        for (unsigned i = 0; i < ready.size(); i++)
+        {
+            ready[i]->upload();
+            uploaded_++;
+        }
+        ready.clear();
+    }
+    pool_->wait();
+    end_ = get_time();
+
+    for (unsigned i = 0; i < assets_.size(); i++)
+        ok = ok && assets_[i]->ok;
+    return ok;
+}
+
+void AssetLoader::printReport() const
+{
+    std::cout << "Loaded " << assets_.size() << " assets in "
+        << (end_ - start_) * 1000.0 << "ms on " << pool_->getNumThreads()
+        << " threads\n";
+    std::cout << std::fixed << std::setprecision(2);
+    for (unsigned i = 0; i < assets_.size(); i++)
+    {
+        const Asset *asset = assets_[i];
+        std::cout << "  " << std::left << std::setw(24) << asset->filename
+            << std::setw(8) << assetTypeNames[asset->type] << std::right
+            << " decode " << std::setw(7) << asset->decodeTime * 1000.0
+            << "ms  upload " << std::setw(7) << asset->uploadTime * 1000.0
+            << "ms" << (asset->ok ? "" : "  FAILED") << '\n';
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "threadpool.h"
+#include "audio.h"
+
+/*
+ * Loads assets in parallel.  Files are read and decoded on a ThreadPool, and
+ * finish() does the GL uploads and adds sounds to audio's table on the
+ * calling thread as each one arrives, so GL and the table are still only used
+ * from one thread.
+ */
+class AssetLoader
+{
+public:
+    explicit AssetLoader(ThreadPool *pool);
+    ~AssetLoader();
+
+    // Each queues an asset, the result is written when finish() uploads it.
+    // Outputs must stay valid until then.
+    void loadShader(GLuint *shader, GLenum type, const char *filename);
+    // Links a program, from the program binary cache if it can
+    void loadProgram(GLuint *program, const char *vertexFile,
+            const char *fragmentFile);
+    void loadTexture(GLuint *texture, const char *filename);
+    // Adds the sound to audio's cache, so later load_sound calls are free
+    void loadSound(const char *filename);
+
+    // Blocks until every queued asset is loaded.  Returns false if any
+    // failed, their errors have already been printed.
+    bool finish();
+    // Prints how long each asset took to decode and upload
+    void printReport() const;
+
+private:
+    enum AssetType
+    {
+        SHADER_ASSET,
+        PROGRAM_ASSET,
+        TEXTURE_ASSET,
+        SOUND_ASSET
+    };
+
+    class Asset : public Task
+    {
+    public:
+        Asset(AssetLoader *loader, AssetType type, const char *filename);
+        virtual ~Asset();
+
+        // Reads and decodes on a pool thread
+        virtual void run();
+        // Reads a file into data or points view into the archive
+        static void readFile(const std::string &filename, void *&data,
+                const void *&view, int &size);
+        // Makes the GL object, or registers the sound, on the main thread
+        void upload();
+
+        AssetLoader *loader;
+        AssetType type;
+        std::string filename;
+        GLuint *object;
+        GLenum shaderType;
+
+        // File contents, or pixels for a texture, if they had to be read
+        void *data;
+        // What gets uploaded, either data or straight from the archive
+        const void *view;
+        int size;
+        // The fragment shader of a program, filename is the vertex shader
+        std::string filename2;
+        void *data2;
+        const void *view2;
+        int size2;
+        int width, height;
+        DecodedSound *sound;
+
+        bool ok;
+        double decodeTime, uploadTime;
+    };
+
+    ThreadPool *pool_;
+    std::vector<Asset*> assets_;
+    unsigned uploaded_;
+    // Time the first asset was queued and the last one finished
+    double start_, end_;
+
+    // Guards decoded_, which pool threads add to as they finish
+    std::mutex lock_;
+    std::condition_variable assetDecoded_;
+    std::vector<Asset*> decoded_;
+
+    Asset* queue(AssetType type, const char *filename);
+
+    AssetLoader(const AssetLoader &);
+};
@@ -1,25 +1,309 @@
 #include "audio.h"
 #include <iostream>
+#include <map>
+#include <string>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <SFML/Audio.hpp>
+#include "archive.h"
 
+// Sound effects are decoded once into memory and shared by everything that
+// loads the same file.  They play through a fixed set of voices, and when
+// every voice is busy the one that started longest ago is cut off.
+static const unsigned NUM_VOICES = 16;
+static const unsigned MAX_SOUNDS = 64;
+
+// The game pushes commands onto a single producer, single consumer ring and
+// the audio thread runs them, so voices and music are only ever touched from
+// that thread.  Decoding sound buffers is safe from any thread.
+// A full queue drops the command rather than block the game.
+static const unsigned QUEUE_SIZE = 256; // must be a power of 2
+static const unsigned MAX_SONG_PATH = 128;
+// How long the audio thread sleeps when there is nothing to do
+static const std::chrono::milliseconds AUDIO_IDLE(1);
+
+enum AudioCommandType
+{
+    PLAY_SOUND,
+    START_SONG,
+    PLAY_SONG,
+    STOP_SONG,
+    MUSIC_VOLUME,
+    SOUND_VOLUME
+};
+
+struct AudioCommand
+{
+    AudioCommandType type;
+    int id;
+    float volume;
+    char filename[MAX_SONG_PATH];
+};
+
+static AudioCommand queue[QUEUE_SIZE];
+// head is only written by the game, tail only by the audio thread
+static std::atomic<unsigned> queueHead(0);
+static std::atomic<unsigned> queueTail(0);
+static unsigned droppedCommands = 0;
+static bool soundsMuted = false;
+
+static std::thread audioThread;
+static std::atomic<bool> audioRunning(false);
+
+// Filled in by load_sound on the game's thread.  A buffer is always stored
+// before any command that plays it is pushed, so the audio thread sees it.
+struct DecodedSound
+{
+    sf::SoundBuffer buffer;
+};
+static DecodedSound *buffers[MAX_SOUNDS];
+static int numSounds = 0;
+static std::map<std::string, int> soundIDs;
+
+// Only touched by the audio thread
 static sf::Music music;
+static sf::Sound voices[NUM_VOICES];
+// When each voice was last started, in sounds played
+static unsigned long voiceStarted[NUM_VOICES];
+static unsigned long playCount = 0;
+
+static void pushCommand(const AudioCommand &command)
+{
+    unsigned head = queueHead.load(std::memory_order_relaxed);
+    if (head - queueTail.load(std::memory_order_acquire) == QUEUE_SIZE)
+    {
+        droppedCommands++;
+        return;
+    }
+    queue[head % QUEUE_SIZE] = command;
+    queueHead.store(head + 1, std::memory_order_release);
+}
+
+static void pushCommand(AudioCommandType type, int id = 0, float volume = 0.0f)
+{
+    AudioCommand command;
+    command.type = type;
+    command.id = id;
+    command.volume = volume;
+    command.filename[0] = '\0';
+    pushCommand(command);
+}
+
+static void playVoice(int id)
+{
+    // Take a free voice, otherwise steal the oldest
+    unsigned voice = 0;
+    for (unsigned i = 0; i < NUM_VOICES; i++)
+    {
+        if (voices[i].GetStatus() == sf::Sound::Stopped)
+        {
+            voice = i;
+            break;
+        }
+        if (voiceStarted[i] < voiceStarted[voice])
+            voice = i;
+    }
+
+    voices[voice].Stop();
+    voices[voice].SetBuffer(buffers[id]->buffer);
+    voices[voice].Play();
+    voiceStarted[voice] = ++playCount;
+}
+
+static bool openSong(const char *filename)
+{
+    // The archive stays mapped, so music can stream from it
+    size_t size;
+    const void *packed = find_asset(filename, &size);
+    if (packed)
+        return music.OpenFromMemory((const char *)packed, size);
+    return music.OpenFromFile(filename);
+}
+
+static void runCommand(const AudioCommand &command)
+{
+    switch (command.type)
+    {
+    case PLAY_SOUND:
+        playVoice(command.id);
+        break;
+    case START_SONG:
+        if (!openSong(command.filename))
+        {
+            std::cout << "Unable to open music file\n";
+            break;
+        }
+        music.SetLoop(true);
+        music.Play();
+        break;
+    case PLAY_SONG:
+        music.Play();
+        break;
+    case STOP_SONG:
+        music.Stop();
+        break;
+    case MUSIC_VOLUME:
+        music.SetVolume(command.volume);
+        break;
+    case SOUND_VOLUME:
+        for (unsigned i = 0; i < NUM_VOICES; i++)
+            voices[i].SetVolume(command.volume);
+        break;
+    }
+}
+
+// Runs every queued command, returns false if there were none
+static bool runCommands()
+{
+    unsigned tail = queueTail.load(std::memory_order_relaxed);
+    unsigned head = queueHead.load(std::memory_order_acquire);
+    if (tail == head)
+        return false;
+    for (; tail != head; tail++)
+        runCommand(queue[tail % QUEUE_SIZE]);
+    queueTail.store(tail, std::memory_order_release);
+    return true;
+}
+
+static void audioMain()
+{
+    while (audioRunning.load(std::memory_order_relaxed))
+    {
+        if (!runCommands())
+            std::this_thread::sleep_for(AUDIO_IDLE);
+    }
+    runCommands();
+}
+
+void start_audio()
+{
+    if (audioRunning)
+        return;
+    audioRunning = true;
+    audioThread = std::thread(audioMain);
+}
+
+void stop_audio()
+{
+    if (!audioRunning)
+        return;
+    audioRunning = false;
+    audioThread.join();
+    if (droppedCommands)
+        std::cout << "Audio queue was full, dropped " << droppedCommands << " commands\n";
+}
 
 void start_song(const char *filename)
 {
-    if (!music.OpenFromFile(filename))
+    if (strlen(filename) >= MAX_SONG_PATH)
     {
-        std::cout << "Unable to open music file\n";
+        std::cout << "Music file name too long: " << filename << '\n';
         return;
     }
-    music.SetLoop(true);
-    music.Play();
+    AudioCommand command;
+    command.type = START_SONG;
+    command.id = 0;
+    command.volume = 0.0f;
+    strcpy(command.filename, filename);
+    pushCommand(command);
 }
 
 void stop_song()
 {
-    music.Stop();
-};
+    pushCommand(STOP_SONG);
+}
 
 void play_song()
 {
-    music.Play();
+    pushCommand(PLAY_SONG);
+}
+
+void set_music_volume(float volume)
+{
+    pushCommand(MUSIC_VOLUME, 0, volume);
+}
+
+void set_sound_volume(float volume)
+{
+    pushCommand(SOUND_VOLUME, 0, volume);
+}
+
+// Decodes data, or the file if data is NULL.  Touches nothing shared, so
+// any thread can decode.
+DecodedSound *decode_sound(const char *filename, const void *data, size_t size)
+{
+    DecodedSound *sound = new DecodedSound();
+    bool ok = data ? sound->buffer.LoadFromMemory((const char *)data, size)
+        : sound->buffer.LoadFromFile(filename);
+    if (!ok)
+    {
+        std::cout << "Unable to open sound file " << filename << '\n';
+        delete sound;
+        return NULL;
+    }
+    return sound;
+}
+
+void free_decoded_sound(DecodedSound *sound)
+{
+    delete sound;
+}
+
+int add_decoded_sound(const char *filename, DecodedSound *sound)
+{
+    if (!sound)
+        return -1;
+    // Someone else got there first
+    std::map<std::string, int>::const_iterator it = soundIDs.find(filename);
+    if (it != soundIDs.end())
+    {
+        delete sound;
+        return it->second;
+    }
+    if (numSounds == (int)MAX_SOUNDS)
+    {
+        std::cout << "Too many sounds, unable to load " << filename << '\n';
+        delete sound;
+        return -1;
+    }
+    int id = numSounds++;
+    buffers[id] = sound;
+    soundIDs[filename] = id;
+    return id;
+}
+
+// Decodes data, or the file if data is NULL, unless filename is already
+// loaded.  Packed files are decoded straight from the asset archive.
+static int addSound(const char *filename, const void *data, size_t size)
+{
+    std::map<std::string, int>::const_iterator it = soundIDs.find(filename);
+    if (it != soundIDs.end())
+        return it->second;
+
+    if (!data)
+        data = find_asset(filename, &size);
+    return add_decoded_sound(filename, decode_sound(filename, data, size));
+}
+
+int load_sound(const char *filename)
+{
+    return addSound(filename, NULL, 0);
+}
+
+int load_sound_memory(const char *filename, const void *data, size_t size)
+{
+    return addSound(filename, data, size);
+}
+
+void play_sound(int id)
+{
+    if (id >= 0 && id < numSounds && !soundsMuted)
+        pushCommand(PLAY_SOUND, id);
+}
+
+void set_sounds_muted(bool muted)
+{
+    soundsMuted = muted;
 }
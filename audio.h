@@ -1,7 +1,45 @@
-#pragma once
-
-#include <SFML/Audio.hpp>
-
-void start_song(const char *filename);
-void play_song();
-void stop_song();
+#pragma once
+#include <cstddef>
+
+/*
+ * audio.cpp implements these with SFML, nullaudio.cpp provides a no-op
+ * backend for headless builds.
+ *
+ * Apart from load_sound, calls only queue a command for the audio thread and
+ * never block, so they are safe to make from inside a game tick.  Commands
+ * must all come from one thread.
+ */
+
+// Starts the audio thread, commands queued before this run once it starts
+void start_audio();
+// Runs any queued commands and stops the audio thread
+void stop_audio();
+
+void start_song(const char *filename);
+void play_song();
+void stop_song();
+// Volumes are from 0 to 100
+void set_music_volume(float volume);
+void set_sound_volume(float volume);
+
+// Loads a sound effect and returns an id for it, or -1 on failure.  Loading
+// the same file again returns the same id.
+int load_sound(const char *filename);
+// Same as load_sound, but decodes a file that has already been read into
+// memory.  Later load_sound calls for filename return the same id.
+int load_sound_memory(const char *filename, const void *data, size_t size);
+
+// Loading split in two, so files can be decoded on other threads.
+// decode_sound can be called from any thread, and returns NULL and prints an
+// error on failure.  add_decoded_sound takes ownership of sound and returns
+// its id as load_sound would, it must be called from the game's thread.
+struct DecodedSound;
+DecodedSound *decode_sound(const char *filename, const void *data, size_t size);
+int add_decoded_sound(const char *filename, DecodedSound *sound);
+// Frees a sound that was never added, NULL is ignored
+void free_decoded_sound(DecodedSound *sound);
+// Plays a sound effect loaded by load_sound, ids < 0 are ignored
+void play_sound(int id);
+// While muted play_sound does nothing, for re-simulating ticks that have
+// already been heard
+void set_sounds_muted(bool muted);
@@ -1,9 +1,9 @@
 #version 330
 
 out vec4 outputColor;
-uniform vec3 color;
+flat in vec3 frag_color;
 
 void main()
 {
-    outputColor = vec4(color, 1.0f);
+    outputColor = vec4(frag_color, 1.0f);
 }
@@ -1,19 +1,24 @@
 #version 330
 
+layout(std140) uniform Frame
+{
+    mat4 projection;
+};
+
 layout(location = 0) in vec4 position;
-uniform mat4 transform;
-uniform vec3 color;
+// Per instance
+layout(location = 1) in vec4 rect; // center, then size
+layout(location = 2) in float rotation; // radians, counterclockwise
+layout(location = 3) in vec3 color;
 
-mat4 make_ortho(float l, float r, float b, float t, float n, float f)
-{
-    return mat4(
-        vec4(2.0 / (r - l), 0.0, 0.0, 0.0),
-        vec4(0.0, 2.0 / (t - b), 0.0, 0.0),
-        vec4(0.0, 0.0, -2.0 / (f - n), 0.0),
-        vec4(-(r + l)/ (r - l), -(t + b) / (t - b), - (f + n) / (f - n), 1.0));
-}
+flat out vec3 frag_color;
 
 void main()
 {
-    gl_Position = transform * position;
+    float c = cos(rotation);
+    float s = sin(rotation);
+    vec2 corner = position.xy * rect.zw;
+    vec2 world = rect.xy + vec2(c * corner.x - s * corner.y, s * corner.x + c * corner.y);
+    gl_Position = projection * vec4(world, 0.0f, 1.0f);
+    frag_color = color;
 }
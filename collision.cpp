@@ -0,0 +1,152 @@
+#include "collision.h"
+#include <algorithm>
+
+// Box counts up to this are insertion sorted
+static const unsigned SMALL_SORT_SIZE = 16;
+
+// Sorts box indices by left edge, ties broken by index for repeatability
+struct CollisionSystem::BoxOrder
+{
+    const std::vector<Box> *boxes;
+    bool operator()(unsigned a, unsigned b) const
+    {
+        float aminx = (*boxes)[a].minx, bminx = (*boxes)[b].minx;
+        return aminx < bminx || (aminx == bminx && a < b);
+    }
+};
+
+namespace
+{
+
+// Position of a contact in the resolution order
+int contactRank(const Contact &c)
+{
+    if (c.type == ATTACK_CLASH)
+        return 0;
+    return c.a < c.b ? 1 : 2;
+}
+
+bool contactOrder(const Contact &a, const Contact &b)
+{
+    unsigned alo = std::min(a.a, a.b), ahi = std::max(a.a, a.b);
+    unsigned blo = std::min(b.a, b.b), bhi = std::max(b.a, b.b);
+    if (alo != blo)
+        return alo < blo;
+    if (ahi != bhi)
+        return ahi < bhi;
+    return contactRank(a) < contactRank(b);
+}
+
+}
+
+CollisionSystem::CollisionSystem()
+{}
+
+void CollisionSystem::clear()
+{
+    boxes_.clear();
+}
+
+void CollisionSystem::addHurtbox(unsigned owner, const Rectangle &rect)
+{
+    addBox(owner, rect, false);
+}
+
+void CollisionSystem::addHitbox(unsigned owner, const Rectangle &rect)
+{
+    addBox(owner, rect, true);
+}
+
+void CollisionSystem::addBox(unsigned owner, const Rectangle &rect, bool hitbox)
+{
+    // Same edge arithmetic as Rectangle::overlaps, so results match it
+    Box box;
+    box.minx = rect.x - rect.w/2;
+    box.maxx = rect.x + rect.w/2;
+    box.miny = rect.y - rect.h/2;
+    box.maxy = rect.y + rect.h/2;
+    box.x = rect.x;
+    box.y = rect.y;
+    box.owner = owner;
+    box.hitbox = hitbox;
+    boxes_.push_back(box);
+}
+
+const std::vector<Contact>& CollisionSystem::findContacts()
+{
+    contacts_.clear();
+
+    sorted_.resize(boxes_.size());
+    for (unsigned i = 0; i < sorted_.size(); i++)
+        sorted_[i] = i;
+    // Usually only a handful of boxes, where insertion sort is quickest
+    BoxOrder order = { &boxes_ };
+    if (sorted_.size() > SMALL_SORT_SIZE)
+        std::sort(sorted_.begin(), sorted_.end(), order);
+    else
+    {
+        for (unsigned i = 1; i < sorted_.size(); i++)
+        {
+            unsigned idx = sorted_[i];
+            unsigned j = i;
+            for (; j > 0 && order(idx, sorted_[j - 1]); j--)
+                sorted_[j] = sorted_[j - 1];
+            sorted_[j] = idx;
+        }
+    }
+
+    active_.clear();
+    for (unsigned k = 0; k < sorted_.size(); k++)
+    {
+        const Box &box = boxes_[sorted_[k]];
+
+        // Drop boxes that end before this one starts, nothing later can
+        // overlap them either
+        for (unsigned i = 0; i < active_.size(); )
+        {
+            if (boxes_[active_[i]].maxx <= box.minx)
+            {
+                active_[i] = active_.back();
+                active_.pop_back();
+            }
+            else
+                i++;
+        }
+
+        for (unsigned i = 0; i < active_.size(); i++)
+        {
+            const Box &other = boxes_[active_[i]];
+            if (other.owner == box.owner || (!other.hitbox && !box.hitbox))
+                continue;
+            if (other.maxx > box.minx && other.minx < box.maxx &&
+                    other.maxy > box.miny && other.miny < box.maxy)
+                addContact(other, box);
+        }
+
+        active_.push_back(sorted_[k]);
+    }
+
+    if (contacts_.size() > 1)
+        std::sort(contacts_.begin(), contacts_.end(), contactOrder);
+    return contacts_;
+}
+
+void CollisionSystem::addContact(const Box &a, const Box &b)
+{
+    Contact contact;
+    contact.x = (a.x + b.x) / 2;
+    contact.y = (a.y + b.y) / 2;
+    if (a.hitbox && b.hitbox)
+    {
+        contact.type = ATTACK_CLASH;
+        contact.a = std::min(a.owner, b.owner);
+        contact.b = std::max(a.owner, b.owner);
+    }
+    else
+    {
+        contact.type = ATTACK_HIT;
+        contact.a = a.hitbox ? a.owner : b.owner;
+        contact.b = a.hitbox ? b.owner : a.owner;
+    }
+    contacts_.push_back(contact);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include "Fighter.h"
+
+enum ContactType
+{
+    // Two attack hitboxes overlap
+    ATTACK_CLASH,
+    // An attack hitbox overlaps another fighter
+    ATTACK_HIT
+};
+
+struct Contact
+{
+    ContactType type;
+    // For hits a is the attacker and b the fighter that was hit, for clashes
+    // a < b
+    unsigned a, b;
+    // Midpoint between the centers of the two boxes
+    float x, y;
+};
+
+/*
+ * Finds overlaps between fighter hurtboxes and attack hitboxes.  The boxes
+ * for a tick are added, then sorted along x and swept, so only boxes that
+ * overlap in x are compared.  Storage is kept between ticks.
+ */
+class CollisionSystem
+{
+public:
+    CollisionSystem();
+
+    // Removes all boxes, call at the start of each tick
+    void clear();
+    // The box a fighter can be hit in
+    void addHurtbox(unsigned owner, const Rectangle &rect);
+    // The world space hitbox of owner's active attack
+    void addHitbox(unsigned owner, const Rectangle &rect);
+
+    // Finds every hitbox/hitbox and hitbox/hurtbox overlap between different
+    // owners.  Contacts are ordered by owner pair, then clashes first, then
+    // hits by the lower owner, so the order doesn't depend on positions.
+    const std::vector<Contact>& findContacts();
+
+private:
+    struct Box
+    {
+        float minx, maxx, miny, maxy;
+        float x, y;
+        unsigned owner;
+        bool hitbox;
+    };
+
+    std::vector<Box> boxes_;
+    // Indices into boxes_, sorted by minx
+    std::vector<unsigned> sorted_;
+    // Boxes that may still overlap the next box in the sweep
+    std::vector<unsigned> active_;
+    std::vector<Contact> contacts_;
+
+    struct BoxOrder;
+    void addBox(unsigned owner, const Rectangle &rect, bool hitbox);
+    void addContact(const Box &a, const Box &b);
+};
@@ -1,59 +1,133 @@
 #include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
 #include "explosion.h"
-#include "glutils.h"
+#include "render.h"
+#include "trace.h"
+#include "hash.h"
+#include <cstring>
 
-void Explosion::render(float dt)
-{
-    t_ += dt;
+const ParticleEmitter EXPLOSION_EMITTER = { glm::vec3(1.0f, 0.42f, 0.0f), 30.0f };
+const ParticleEmitter PUFF_EMITTER = { glm::vec3(0.8f, 0.8f, 0.8f), 20.0f };
 
-    float frac = std::min(1.0f, t_ / duration_);
-    glm::mat4 transform = 
-        glm::scale(
-                glm::translate(glm::mat4(1.0f), glm::vec3(x_, y_, 0.0)),
-                frac * glm::vec3(size_, size_, 1.0f));
-    renderRectangle(transform, color_);
-}
+// Room reserved up front, enough for a normal match
+static const unsigned RESERVED_PARTICLES = 512;
 
-bool Explosion::isDone() const
+ExplosionManager::ExplosionManager()
 {
-    return t_ > duration_;
+    x_.reserve(RESERVED_PARTICLES);
+    y_.reserve(RESERVED_PARTICLES);
+    t_.reserve(RESERVED_PARTICLES);
+    duration_.reserve(RESERVED_PARTICLES);
+    size_.reserve(RESERVED_PARTICLES);
+    r_.reserve(RESERVED_PARTICLES);
+    g_.reserve(RESERVED_PARTICLES);
+    b_.reserve(RESERVED_PARTICLES);
 }
 
-ExplosionManager::ExplosionManager()
-{}
-
-ExplosionManager* ExplosionManager::get()
+void ExplosionManager::emit(const ParticleEmitter &emitter, float x, float y, float t)
 {
-    static ExplosionManager em;
-    return &em;
+    x_.push_back(x);
+    y_.push_back(y);
+    t_.push_back(0.0f);
+    duration_.push_back(t);
+    size_.push_back(emitter.size);
+    r_.push_back(emitter.color.r);
+    g_.push_back(emitter.color.g);
+    b_.push_back(emitter.color.b);
 }
 
 void ExplosionManager::addExplosion(float x, float y, float t)
 {
-    explosions_.push_back(Explosion(x, y, t, glm::vec3(1.0f, 0.42f, 0.0f), 30.0f));
+    emit(EXPLOSION_EMITTER, x, y, t);
 }
 
 void ExplosionManager::addPuff(float x, float y, float t)
 {
-    explosions_.push_back(Explosion(x, y, t, glm::vec3(0.8f, 0.8f, 0.8f), 20.0f));
+    emit(PUFF_EMITTER, x, y, t);
 }
 
-void ExplosionManager::render(float dt)
+void ExplosionManager::update(float dt)
 {
-    std::vector<Explosion>::iterator it = explosions_.begin();
-    for (; it != explosions_.end(); )
+    const unsigned n = t_.size();
+    if (n == 0)
+        return;
+
+    // Age everything in one straight loop
+    float *t = &t_[0];
+    for (unsigned i = 0; i < n; i++)
+        t[i] += dt;
+
+    // Then remove the finished particles
+    for (unsigned i = 0; i < t_.size(); )
     {
-        Explosion& ex = *it;
-        // Check for explosion death
-        if (ex.isDone())
-            it = explosions_.erase(it);
-        // Otherwise render it
+        if (t_[i] > duration_[i])
+            remove(i);
         else
-        {
-            ex.render(dt);
-            // Next explosion
-            it++;
-        }
+            i++;
+    }
+}
+
+void ExplosionManager::remove(unsigned i)
+{
+    // Move the last particle into this slot
+    x_[i] = x_.back(); x_.pop_back();
+    y_[i] = y_.back(); y_.pop_back();
+    t_[i] = t_.back(); t_.pop_back();
+    duration_[i] = duration_.back(); duration_.pop_back();
+    size_[i] = size_.back(); size_.pop_back();
+    r_[i] = r_.back(); r_.pop_back();
+    g_[i] = g_.back(); g_.pop_back();
+    b_[i] = b_.back(); b_.pop_back();
+}
+
+void ExplosionManager::render()
+{
+    TraceScope span(TRACE_EXPLOSIONS_RENDER_SPAN);
+    for (unsigned i = 0; i < t_.size(); i++)
+    {
+        // Grow to full size over the lifetime
+        float frac = std::min(1.0f, t_[i] / duration_[i]);
+        renderRectangle(glm::vec2(x_[i], y_[i]), frac * glm::vec2(size_[i], size_[i]),
+                glm::vec3(r_[i], g_[i], b_[i]));
     }
 }
+
+unsigned ExplosionManager::getNumParticles() const
+{
+    return t_.size();
+}
+
+void ExplosionManager::save(ParticleSnapshot &snapshot) const
+{
+    const unsigned n = t_.size();
+    snapshot.count = n;
+    snapshot.data.resize(n * PARTICLE_FIELDS);
+    if (n == 0)
+        return;
+    const std::vector<float> *fields[PARTICLE_FIELDS] =
+        { &x_, &y_, &t_, &duration_, &size_, &r_, &g_, &b_ };
+    for (unsigned f = 0; f < PARTICLE_FIELDS; f++)
+        memcpy(&snapshot.data[f * n], &(*fields[f])[0], n * sizeof(float));
+}
+
+void ExplosionManager::restore(const ParticleSnapshot &snapshot)
+{
+    // Within the capacity the particles already grew to, this doesn't allocate
+    const unsigned n = snapshot.count;
+    const float *data = n ? &snapshot.data[0] : NULL;
+    std::vector<float> *fields[PARTICLE_FIELDS] =
+        { &x_, &y_, &t_, &duration_, &size_, &r_, &g_, &b_ };
+    for (unsigned f = 0; f < PARTICLE_FIELDS; f++)
+        fields[f]->assign(data + f * n, data + (f + 1) * n);
+}
+
+ParticleSnapshot::ParticleSnapshot() :
+    count(0)
+{}
+
+uint64_t ParticleSnapshot::hash(uint64_t h) const
+{
+    h = hash_bytes(&count, sizeof(count), h);
+    if (count == 0)
+        return h;
+    return hash_bytes(&data[0], count * PARTICLE_FIELDS * sizeof(float), h);
+}
@@ -1,28 +1,51 @@
 #pragma once
 #include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
 
-class Explosion
+// Parameters shared by every particle an emitter makes
+struct ParticleEmitter
 {
-public:
-    Explosion(float x, float y, float dur, const glm::vec3& col, float size) :
-        x_(x), y_(y), t_(0), duration_(dur), color_(col), size_(size)
-    {}
+    glm::vec3 color;
+    // Size the particle grows to over its lifetime
+    float size;
+};
 
-    void render(float dt);
-    bool isDone() const;
+// Presets used by the game
+extern const ParticleEmitter EXPLOSION_EMITTER;
+extern const ParticleEmitter PUFF_EMITTER;
 
-private:
-    float x_, y_;
-    float t_;
-    float duration_;
-    glm::vec3 color_;
-    float size_;
+// Number of arrays a particle is stored across
+static const unsigned PARTICLE_FIELDS = 8;
+
+// Flat copy of an ExplosionManager's particles
+struct ParticleSnapshot
+{
+    ParticleSnapshot();
+
+    uint32_t count;
+    // x, y, t, duration, size, r, g and b, each count floats long, one after
+    // another.  Saving again reuses it, so it only allocates when it grows.
+    std::vector<float> data;
+
+    uint64_t hash(uint64_t h) const;
 };
 
+/*
+ * Particles are stored as a structure of arrays.  Dead particles are removed
+ * by swapping the last particle into their slot.  The arrays grow as needed
+ * and keep their capacity, so once a match has warmed up adding particles
+ * doesn't allocate.
+ */
+
+// Each Match owns one of these
 class ExplosionManager
 {
 public:
-    static ExplosionManager* get();
+    ExplosionManager();
+
+    // Adds a particle at game coordinates x,y that lasts for t seconds
+    void emit(const ParticleEmitter &emitter, float x, float y, float t);
 
     // Adds an explosion at game coordinates x,y with duration t
     void addExplosion(float x, float y, float t);
@@ -30,13 +53,24 @@ public:
     // Adds a colored 'puff' for dashing or landing
     void addPuff(float x, float y, float t);
 
+    // Ages all particles by dt and removes the finished ones
+    void update(float dt);
+
     // Renders all explosions on the screen
-    void render(float dt);
+    void render();
+
+    unsigned getNumParticles() const;
+
+    void save(ParticleSnapshot &snapshot) const;
+    void restore(const ParticleSnapshot &snapshot);
 
 private:
-    // Private shits for singleton
-    ExplosionManager();
-    ExplosionManager(const ExplosionManager&);
+    std::vector<float> x_, y_;
+    std::vector<float> t_, duration_;
+    std::vector<float> size_;
+    std::vector<float> r_, g_, b_;
 
-    std::vector<Explosion> explosions_;
+    void remove(unsigned i);
+
+    ExplosionManager(const ExplosionManager&);
 };
@@ -1,23 +1,124 @@
 #include <GL/glew.h>
 #include <cstdlib>
 #include <cstdio>
+#include <cstddef>
 #include <iostream>
 #include <glm/glm.hpp>
-#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/stat.h>
 #include "util.h"
 #include "glutils.h"
+#include "hash.h"
+
+// Per instance data for one rectangle in the batch, the projection is
+// applied in the vertex shader
+struct RectInstance
+{
+    glm::vec2 center;
+    glm::vec2 size;
+    float rotation;
+    glm::vec3 color;
+};
+// Fails to compile if the record stops being two vec4s
+typedef char rectInstanceCheck[sizeof(RectInstance) == 32 ? 1 : -1];
+
+// Vertex attribute locations in bbox.v.glsl
+enum
+{
+    POSITION_ATTRIB = 0,
+    RECT_ATTRIB = 1,
+    ROTATION_ATTRIB = 2,
+    COLOR_ATTRIB = 3
+};
+
+// Uniform buffer binding of the Frame block shared by both programs
+static const GLuint FRAME_BINDING = 0;
+
+// Matches the std140 Frame block in the vertex shaders
+struct FrameUniforms
+{
+    glm::mat4 projection;
+};
 
 static struct 
 {
     GLuint vertex_buffer, element_buffer;
-    GLuint vertex_shader, fragment_shader;
     GLuint program;
-    GLuint texvertex_shader, texfragment_shader;
     GLuint texprogram;
+    GLint texrect_uniform;
+    GLuint frame_buffer;
+
+    // Attribute setup for each program, made once in initGLUtils
+    GLuint rect_vao, tex_vao;
 
-    glm::mat4 perspective;
+    // Streamed every flush with the rectangles queued since the last one
+    GLuint instance_buffer;
+    std::vector<RectInstance> rects;
 } resources;
 
+// What's currently bound, so binding it again can be skipped.  Anything
+// binding behind the cache's back has to go through reset_gl_state.
+static struct
+{
+    GLuint program;
+    GLuint vertex_array;
+    GLuint array_buffer;
+    GLuint texture;
+} bound;
+
+// GL calls made by the draw functions since takeGLCallCount
+static unsigned gl_calls = 0;
+
+static void reset_gl_state()
+{
+    glUseProgram(0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    memset(&bound, 0, sizeof(bound));
+}
+
+static void use_program(GLuint program)
+{
+    if (bound.program == program)
+        return;
+    glUseProgram(program);
+    bound.program = program;
+    gl_calls++;
+}
+
+static void bind_vertex_array(GLuint vertex_array)
+{
+    if (bound.vertex_array == vertex_array)
+        return;
+    glBindVertexArray(vertex_array);
+    bound.vertex_array = vertex_array;
+    gl_calls++;
+}
+
+static void bind_array_buffer(GLuint buffer)
+{
+    if (bound.array_buffer == buffer)
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    bound.array_buffer = buffer;
+    gl_calls++;
+}
+
+static void bind_texture(GLuint texture)
+{
+    if (bound.texture == texture)
+        return;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    bound.texture = texture;
+    gl_calls++;
+}
+
 
 GLuint make_buffer( GLenum target, const void *buffer_data, GLsizei buffer_size)
 {
@@ -44,24 +145,19 @@ void show_info_log(
     free(log);
 }
 
-GLuint make_shader(GLenum type, const char *filename)
+GLuint make_shader_source(GLenum type, const char *source, GLint length,
+        const char *name)
 {
-    GLint length;
-    GLchar *source = (GLchar *)file_contents(filename, &length);
     GLuint shader;
     GLint shader_ok;
 
-    if (!source)
-        return 0;
-
     shader = glCreateShader(type);
     glShaderSource(shader, 1, (const GLchar**)&source, &length);
-    free(source);
     glCompileShader(shader);
 
     glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_ok);
     if (!shader_ok) {
-        fprintf(stderr, "Failed to compile %s:\n", filename);
+        fprintf(stderr, "Failed to compile %s:\n", name);
         show_info_log(shader, glGetShaderiv, glGetShaderInfoLog);
         glDeleteShader(shader);
         return 0;
@@ -69,6 +165,20 @@ GLuint make_shader(GLenum type, const char *filename)
     return shader;
 }
 
+GLuint make_shader(GLenum type, const char *filename)
+{
+    GLint length;
+    GLchar *source = (GLchar *)file_contents(filename, &length);
+    GLuint shader;
+
+    if (!source)
+        return 0;
+
+    shader = make_shader_source(type, source, length, filename);
+    free(source);
+    return shader;
+}
+
 GLuint make_program(GLuint vertex_shader, GLuint fragment_shader)
 {
     GLint program_ok;
@@ -89,14 +199,173 @@ GLuint make_program(GLuint vertex_shader, GLuint fragment_shader)
     return program;
 } 
 
-GLuint make_texture(const char *filename)
+// Linked programs are saved in SHADER_CACHE_DIR, named by a hash of their
+// sources and the GL driver, and loaded back with glProgramBinary.  Anything
+// that doesn't match or won't load falls back to compiling.
+static const char SHADER_CACHE_DIR[] = ".shadercache";
+static const char SHADER_CACHE_MAGIC[4] = { 'G', 'S', 'S', 'C' };
+
+struct ShaderCacheHeader
 {
-    int width, height;
-    void *pixels = read_tga(filename, &width, &height);
-    GLuint texture;
+    char magic[4];
+    GLenum format;
+    uint64_t key;
+    GLint length;
+};
 
-    if (!pixels)
+static uint64_t program_cache_key(const char *vertex_source, GLint vertex_length,
+        const char *fragment_source, GLint fragment_length)
+{
+    const GLubyte *driver[] = {
+        glGetString(GL_VENDOR), glGetString(GL_RENDERER), glGetString(GL_VERSION)
+    };
+    uint64_t h = hash_bytes(vertex_source, vertex_length);
+    h = hash_bytes(fragment_source, fragment_length, h);
+    for (int i = 0; i < 3; i++) {
+        const char *str = driver[i] ? (const char *)driver[i] : "";
+        h = hash_bytes(str, strlen(str), h);
+    }
+    return h;
+}
+
+static std::string program_cache_path(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+    return SHADER_CACHE_DIR + std::string(name);
+}
+
+static bool program_binaries_supported()
+{
+    GLint formats = 0;
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+        return false;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static GLuint load_cached_program(uint64_t key)
+{
+    std::string path = program_cache_path(key);
+    struct stat st;
+    GLint length;
+    char *file;
+    GLuint program;
+    GLint program_ok;
+    ShaderCacheHeader header;
+
+    // Not being cached yet isn't an error
+    if (stat(path.c_str(), &st) != 0)
+        return 0;
+    file = (char *)file_contents(path.c_str(), &length);
+    if (!file)
+        return 0;
+    memcpy(&header, file, std::min<size_t>(sizeof(header), length));
+    if (length < (GLint)sizeof(header)
+            || memcmp(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic))
+            || header.key != key
+            || header.length != length - (GLint)sizeof(header)) {
+        free(file);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    glProgramBinary(program, header.format, file + sizeof(header), header.length);
+    free(file);
+
+    // Drivers reject binaries from other versions here
+    glGetProgramiv(program, GL_LINK_STATUS, &program_ok);
+    if (!program_ok) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static void save_cached_program(GLuint program, uint64_t key)
+{
+    ShaderCacheHeader header;
+    std::vector<char> binary;
+    std::string path = program_cache_path(key);
+    std::string tmppath = path + ".tmp";
+    FILE *f;
+
+    // No uninitialized padding bytes in the file
+    memset(&header, 0, sizeof(header));
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+    if (header.length <= 0)
+        return;
+    binary.resize(header.length);
+    glGetProgramBinary(program, header.length, &header.length, &header.format,
+            &binary[0]);
+    memcpy(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic));
+    header.key = key;
+
+    mkdir(SHADER_CACHE_DIR, 0755);
+    f = fopen(tmppath.c_str(), "wb");
+    if (!f) {
+        fprintf(stderr, "Unable to write shader cache %s\n", tmppath.c_str());
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(&binary[0], 1, header.length, f) == (size_t)header.length;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmppath.c_str(), path.c_str()) != 0)
+        remove(tmppath.c_str());
+}
+
+GLuint make_program_source(const char *vertex_source, GLint vertex_length,
+        const char *fragment_source, GLint fragment_length, const char *name)
+{
+    bool cache = program_binaries_supported();
+    uint64_t key = 0;
+    GLuint vertex_shader, fragment_shader, program;
+    GLint program_ok;
+
+    if (cache) {
+        key = program_cache_key(vertex_source, vertex_length,
+                fragment_source, fragment_length);
+        program = load_cached_program(key);
+        if (program)
+            return program;
+    }
+
+    vertex_shader = make_shader_source(GL_VERTEX_SHADER, vertex_source,
+            vertex_length, name);
+    fragment_shader = make_shader_source(GL_FRAGMENT_SHADER, fragment_source,
+            fragment_length, name);
+    if (!vertex_shader || !fragment_shader) {
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    if (cache)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    // The program keeps what it needs
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &program_ok);
+    if (!program_ok) {
+        fprintf(stderr, "Failed to link %s:\n", name);
+        show_info_log(program, glGetProgramiv, glGetProgramInfoLog);
+        glDeleteProgram(program);
         return 0;
+    }
+
+    if (cache)
+        save_cached_program(program, key);
+    return program;
+}
+
+GLuint make_texture_pixels(const void *pixels, int width, int height)
+{
+    GLuint texture;
 
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
@@ -111,11 +380,25 @@ GLuint make_texture(const char *filename)
             GL_BGR, GL_UNSIGNED_BYTE,   /* external format, type */
             pixels                      /* pixels */
             );
+    return texture;
+}
+
+GLuint make_texture(const char *filename)
+{
+    int width, height;
+    void *pixels = read_tga(filename, &width, &height);
+    GLuint texture;
+
+    if (!pixels)
+        return 0;
+
+    texture = make_texture_pixels(pixels, width, height);
     free(pixels);
     return texture;
 }
 
-bool initGLUtils(const glm::mat4 &perspectiveTransform)
+bool initGLUtils(const glm::mat4 &perspectiveTransform, GLuint program,
+        GLuint texprogram)
 {
     // The datas
     const GLfloat vertex_buffer_data[] = { 
@@ -127,79 +410,127 @@ bool initGLUtils(const glm::mat4 &perspectiveTransform)
     };
     const GLushort element_buffer_data[] = { 0, 1, 2, 3 };
 
+    resources.program = program;
+    resources.texprogram = texprogram;
+    if (resources.program == 0 || resources.texprogram == 0)
+        return false;
+
+    // The element buffer binding belongs to the vertex array, so make sure
+    // none is bound while the buffers are made
+    glBindVertexArray(0);
     resources.vertex_buffer = make_buffer(GL_ARRAY_BUFFER, vertex_buffer_data, sizeof(vertex_buffer_data));
     resources.element_buffer = make_buffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_data, sizeof(element_buffer_data));
+    resources.instance_buffer = make_buffer(GL_ARRAY_BUFFER, NULL, 0);
 
-    resources.vertex_shader = make_shader(GL_VERTEX_SHADER, "bbox.v.glsl");
-    if (resources.vertex_shader == 0)
-        return false;
-    resources.fragment_shader = make_shader(GL_FRAGMENT_SHADER, "bbox.f.glsl");
-    if (resources.fragment_shader == 0)
-        return false;
+    // Rectangles: the shared quad plus the streamed per instance data
+    glGenVertexArrays(1, &resources.rect_vao);
+    glBindVertexArray(resources.rect_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, resources.vertex_buffer);
+    glEnableVertexAttribArray(POSITION_ATTRIB);
+    glVertexAttribPointer(POSITION_ATTRIB, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, resources.instance_buffer);
+    glEnableVertexAttribArray(RECT_ATTRIB);
+    glVertexAttribPointer(RECT_ATTRIB, 4, GL_FLOAT, GL_FALSE,
+            sizeof(RectInstance), (void *) offsetof(RectInstance, center));
+    glVertexAttribDivisor(RECT_ATTRIB, 1);
+    glEnableVertexAttribArray(ROTATION_ATTRIB);
+    glVertexAttribPointer(ROTATION_ATTRIB, 1, GL_FLOAT, GL_FALSE,
+            sizeof(RectInstance), (void *) offsetof(RectInstance, rotation));
+    glVertexAttribDivisor(ROTATION_ATTRIB, 1);
+    glEnableVertexAttribArray(COLOR_ATTRIB);
+    glVertexAttribPointer(COLOR_ATTRIB, 3, GL_FLOAT, GL_FALSE,
+            sizeof(RectInstance), (void *) offsetof(RectInstance, color));
+    glVertexAttribDivisor(COLOR_ATTRIB, 1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, resources.element_buffer);
 
-    resources.program = make_program(resources.vertex_shader, resources.fragment_shader);
-    
-    resources.texvertex_shader = make_shader(GL_VERTEX_SHADER, "texbox.v.glsl");
-    if (resources.texvertex_shader == 0)
-        return false;
-    resources.texfragment_shader = make_shader(GL_FRAGMENT_SHADER, "texbox.f.glsl");
-    if (resources.texfragment_shader == 0)
-        return false;
-    resources.texprogram = make_program(resources.texvertex_shader, resources.texfragment_shader);
+    // Textured rectangles: just the quad
+    glGenVertexArrays(1, &resources.tex_vao);
+    glBindVertexArray(resources.tex_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, resources.vertex_buffer);
+    glEnableVertexAttribArray(POSITION_ATTRIB);
+    glVertexAttribPointer(POSITION_ATTRIB, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, resources.element_buffer);
+
+    // Uniforms that never change are set once here
+    resources.texrect_uniform = glGetUniformLocation(resources.texprogram, "rect");
+    glUseProgram(resources.texprogram);
+    glUniform1i(glGetUniformLocation(resources.texprogram, "tex"), 0);
 
-    resources.perspective = perspectiveTransform;
+    // Both programs read the projection from the same uniform buffer
+    FrameUniforms frame;
+    frame.projection = perspectiveTransform;
+    resources.frame_buffer = make_buffer(GL_UNIFORM_BUFFER, &frame, sizeof(frame));
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, resources.frame_buffer);
+    glUniformBlockBinding(resources.program,
+            glGetUniformBlockIndex(resources.program, "Frame"), FRAME_BINDING);
+    glUniformBlockBinding(resources.texprogram,
+            glGetUniformBlockIndex(resources.texprogram, "Frame"), FRAME_BINDING);
+
+    reset_gl_state();
 
     return true;
 }
 
 void cleanGLUtils()
 {
+    reset_gl_state();
+    glDeleteVertexArrays(1, &resources.rect_vao);
+    glDeleteVertexArrays(1, &resources.tex_vao);
+    glDeleteBuffers(1, &resources.vertex_buffer);
+    glDeleteBuffers(1, &resources.element_buffer);
+    glDeleteBuffers(1, &resources.instance_buffer);
+    glDeleteBuffers(1, &resources.frame_buffer);
 }
 
-void renderRectangle(const glm::mat4 &transform, const glm::vec3 &color)
+unsigned takeGLCallCount()
 {
-    GLuint transformUniform = glGetUniformLocation(resources.program, "transform");
-    GLuint colorUniform = glGetUniformLocation(resources.program, "color");
+    unsigned calls = gl_calls;
+    gl_calls = 0;
+    return calls;
+}
 
-    // Enable program and set up values
-    glUseProgram(resources.program);
-    glUniformMatrix4fv(transformUniform, 1, GL_FALSE, glm::value_ptr(resources.perspective * transform));
-    glUniform3fv(colorUniform, 1, glm::value_ptr(color));
+void renderRectangle(const glm::vec2 &center, const glm::vec2 &size,
+        const glm::vec3 &color, float rotation)
+{
+    // Just queue it, everything is drawn at once by flushRectangles
+    RectInstance rect;
+    rect.center = center;
+    rect.size = size;
+    rect.rotation = rotation;
+    rect.color = color;
+    resources.rects.push_back(rect);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, resources.vertex_buffer);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+void flushRectangles()
+{
+    if (resources.rects.empty())
+        return;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, resources.element_buffer);
-    glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT, 0);
+    use_program(resources.program);
+    bind_vertex_array(resources.rect_vao);
 
-    // Clean up
-    glDisableVertexAttribArray(0);
-    glUseProgram(0);
+    // Upload this batch, orphaning the last one
+    bind_array_buffer(resources.instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, resources.rects.size() * sizeof(RectInstance),
+            &resources.rects[0], GL_STREAM_DRAW);
+    glDrawElementsInstanced(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT, 0,
+            resources.rects.size());
+    gl_calls += 2;
+
+    resources.rects.clear();
 }
 
-void renderTexturedRectangle(const glm::mat4 &transform, GLuint texture)
+void renderTexturedRectangle(const glm::vec2 &center, const glm::vec2 &size,
+        GLuint texture)
 {
-    GLuint transformUniform = glGetUniformLocation(resources.texprogram, "transform");
-    GLuint textureUniform = glGetUniformLocation(resources.texprogram, "texture");
+    // Keep draw order, anything queued so far goes underneath
+    flushRectangles();
 
-    // Enable program and set up values
-    glUseProgram(resources.texprogram);
-    glUniformMatrix4fv(transformUniform, 1, GL_FALSE, glm::value_ptr(resources.perspective * transform));
-    glUniform1i(textureUniform, 0);
+    use_program(resources.texprogram);
+    bind_vertex_array(resources.tex_vao);
+    bind_texture(texture);
 
-    glActiveTexture(GL_TEXTURE0);
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glBindBuffer(GL_ARRAY_BUFFER, resources.vertex_buffer);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, resources.element_buffer);
+    glUniform4f(resources.texrect_uniform, center.x, center.y, size.x, size.y);
     glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT, 0);
-
-    // Clean up
-    glDisableVertexAttribArray(0);
-    glUseProgram(0);
+    gl_calls += 2;
 }
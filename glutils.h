@@ -1,19 +1,39 @@
 #pragma once
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include "render.h"
 
 GLuint make_buffer( GLenum target, const void *buffer_data, GLsizei buffer_size);
 
 void show_info_log( GLuint object, PFNGLGETSHADERIVPROC glGet__iv, PFNGLGETSHADERINFOLOGPROC glGet__InfoLog);
 
 GLuint make_shader(GLenum type, const char *filename);
+// Compiles source already in memory, name is only used in error messages
+GLuint make_shader_source(GLenum type, const char *source, GLint length,
+        const char *name);
 
 GLuint make_program(GLuint vertex_shader, GLuint fragment_shader);
+// Compiles and links a program from sources in memory, or loads it from the
+// program binary cache when the sources and GL driver match a cached copy.
+// name is only used in error messages.
+GLuint make_program_source(const char *vertex_source, GLint vertex_length,
+        const char *fragment_source, GLint fragment_length, const char *name);
 
 GLuint make_texture(const char *filename);
+// Uploads 24 bit BGR pixels, as returned by read_tga
+GLuint make_texture_pixels(const void *pixels, int width, int height);
 
-bool initGLUtils(const glm::mat4 &perspectiveTrans);
+// Takes the linked bbox and texbox programs, returns false if either is 0.
+// The projection goes to both programs' vertex shaders.
+bool initGLUtils(const glm::mat4 &perspectiveTrans, GLuint program,
+        GLuint texprogram);
 void cleanGLUtils();
+// GL calls made by the draw functions since the last call, redundant binds
+// are skipped and not counted
+unsigned takeGLCallCount();
 
-void renderRectangle(const glm::mat4 &transform, const glm::vec3 &color);
-void renderTexturedRectangle(const glm::mat4 &transform, GLuint texture);
+void renderTexturedRectangle(const glm::vec2 &center, const glm::vec2 &size,
+        GLuint texture);
+// Draws every rectangle queued by renderRectangle with one instanced draw
+// call, must be called before swapping buffers
+void flushRectangles();
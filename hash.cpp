@@ -0,0 +1,25 @@
+#include "hash.h"
+#include <cstring>
+
+static const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t mix(uint64_t h, uint64_t word)
+{
+    h = (h ^ word) * HASH_MULTIPLIER;
+    return h ^ (h >> 29);
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t h)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint64_t word;
+    for (; size >= sizeof(word); bytes += sizeof(word), size -= sizeof(word))
+    {
+        memcpy(&word, bytes, sizeof(word));
+        h = mix(h, word);
+    }
+    // The tail, with its length so "a" and "a\0" differ
+    word = 0;
+    memcpy(&word, bytes, size);
+    return mix(h, word ^ ((uint64_t) size << 56));
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include <stdint.h>
+
+static const uint64_t HASH_SEED = 0x6a09e667f3bcc908ULL;
+
+// Fast 64 bit hash of size bytes, eight at a time.  Chain calls by passing
+// the last result as h.  The same bytes always give the same hash, but it is
+// not meant to resist deliberate collisions.
+uint64_t hash_bytes(const void *data, size_t size, uint64_t h = HASH_SEED);
@@ -5,14 +5,33 @@
 #include <cstdlib>
 #include <cmath>
 #include <vector>
+#include <string>
 #include "glutils.h"
 #include "Fighter.h"
+#include "match.h"
 #include "audio.h"
 #include "explosion.h"
 #include "ParamReader.h"
+#include "replay.h"
+#include "timer.h"
+#include "paramwatcher.h"
+#include "assets.h"
+#include "archive.h"
+#include "profiler.h"
+#include "trace.h"
+#include "rollback.h"
+#include "transport.h"
 
 static const float MAX_JOYSTICK_VALUE = 32767.0f;
+// Fixed simulation timestep
 static const float dt = 33.0f / 1000.0f;
+// Frames longer than this are clamped, so a stall doesn't cause a burst of
+// catch up updates
+static const float MAX_FRAME_TIME = 0.25f;
+// Minimum time between rendered frames
+static const float MIN_RENDER_TIME = 1.0f / 120.0f;
+// The HUD only has room for this many players, bigger matches are for ssb-sim
+static const unsigned MAX_LOCAL_PLAYERS = 4;
 
 static float WORLD_W = 1500.0f;
 static float WORLD_H = 750.0f;
@@ -20,24 +39,42 @@ static int SCREEN_W = 1920;
 static int SCREEN_H = 1080;
 
 bool running;
+// Simulate as fast as possible instead of in real time
+bool fastMode = false;
 SDL_Joystick *joystick;
 
-unsigned numPlayers = 1;
+// Controller input is recorded to recorder if it is open, and read from
+// playback instead of the joysticks if that is open
+ReplayWriter recorder;
+ReplayReader playback;
+// Frames recorded so far, and whether playback has gone differently from
+// the replay's checksums
+unsigned recordedFrames = 0;
+bool playbackDesynced = false;
+// Reused for each keyframe recorded
+MatchSnapshot keyframe;
 
-Controller controllers[4];
-std::vector<Fighter*> fighters;
-const glm::vec3 playerColors[] =
-{
-    glm::vec3(0.2, 0.2, 0.8),
-    glm::vec3(0.2, 0.8, 0.2),
-    glm::vec3(0.8, 0.2, 0.2),
-    glm::vec3(0.8, 0.8, 0.2)
-};
+// Reloads params.dat when it's saved, for tuning while playing
+ParamWatcher paramWatcher;
+
+// Times each phase of the frame with --profile, or after pressing t
+FrameProfiler profiler;
+bool profile = false;
+
+Match *match = NULL;
+Controller controllers[MAX_PLAYERS];
+
+// Online play against one remote player with --netplay.  The session owns
+// the match, and the local player uses the first joystick.
+UdpTransport transport;
+RollbackSession *session = NULL;
 
 GLuint backgroundTex = 0;
+// GL calls per rendered frame, reported on exit
+unsigned long renderedFrames = 0, totalGLCalls = 0;
+unsigned maxGLCalls = 0;
 const glm::mat4 perspectiveTransform = glm::ortho(-WORLD_W/2, WORLD_W/2, -WORLD_H/2, WORLD_H/2, -1.0f, 1.0f);
 
-Rectangle ground;
 const glm::vec3 groundColor(0.5f, 0.5f, 0.5f);
 
 
@@ -48,28 +85,112 @@ void cleanup();
 
 void mainloop();
 void processInput();
-void update();
-void render();
+// Records the frame just simulated, and checks it against the replay being
+// played
+void recordFrame();
+void render(float alpha, float frameTime);
+void renderHUD(const Rectangle &ground);
 
 void updateController(Controller &controller);
 void controllerEvent(Controller &controller, const SDL_Event &event);
 
 int main(int argc, char **argv)
 {
-    if (argc > 2)
+    std::string recordFile, playbackFile, traceFile;
+    std::string netplayHost;
+    unsigned netplayPlayer = 0, netplayPort = 0, netplayRemotePort = 0;
+    unsigned frameDelay = 2;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        std::string arg = argv[argi];
+        if (arg == "--fast")
+            fastMode = true;
+        else if (arg == "--record" && argi + 1 < argc)
+            recordFile = argv[++argi];
+        else if (arg == "--play" && argi + 1 < argc)
+            playbackFile = argv[++argi];
+        else if (arg == "--profile")
+            profile = true;
+        else if (arg == "--netplay" && argi + 3 < argc)
+        {
+            netplayPlayer = atoi(argv[++argi]);
+            netplayPort = atoi(argv[++argi]);
+            netplayHost = argv[++argi];
+            size_t colon = netplayHost.rfind(':');
+            if (colon != std::string::npos)
+            {
+                netplayRemotePort = atoi(netplayHost.c_str() + colon + 1);
+                netplayHost.erase(colon);
+            }
+        }
+        else if (arg == "--delay" && argi + 1 < argc)
+            frameDelay = std::max(0, atoi(argv[++argi]));
+        else if (arg == "--trace" && argi + 1 < argc)
+            traceFile = argv[++argi];
+        else if (arg == "--trace-filter" && argi + 1 < argc)
+        {
+            unsigned categories;
+            if (!parse_trace_categories(argv[++argi], &categories))
+                exit(1);
+            set_trace_categories(categories);
+        }
+        else
+            break;
+    }
+    bool netplay = netplayPlayer != 0;
+    if (argc - argi > 1 || (argi < argc && argv[argi][0] == '-')
+            || (netplay && (netplayPlayer > 2 || netplayPort == 0 || netplayRemotePort == 0
+                    || fastMode || !playbackFile.empty()
+                    || argi < argc)))
     {
-        std::cout << "usage: " << argv[0] << " [nplayers]\n";
+        std::cout << "usage: " << argv[0] << " [--fast] [--profile] [--trace FILE [--trace-filter CATEGORY,...]] [--record FILE | --play FILE] [nplayers]\n"
+            << "       " << argv[0] << " [--profile] [--trace FILE [--trace-filter CATEGORY,...]] [--record FILE] --netplay PLAYER LOCALPORT HOST:PORT [--delay FRAMES]\n";
         exit(1);
     }
-    if (argc == 2)
+    unsigned nplayers = 1;
+    if (argi < argc)
     {
-        numPlayers = std::min(4, std::max(1, atoi(argv[1])));
+        nplayers = std::min<int>(MAX_LOCAL_PLAYERS, std::max(1, atoi(argv[argi])));
     }
 
+    // Assets come from the archive if there is one, loose files otherwise
+    if (open_asset_archive("ssb.pak"))
+        std::cout << "Using assets from ssb.pak\n";
+
+    // Init game state
+    ParamReader params("params.dat");
+    if (!params.isValid())
+        exit(1);
+    if (!playbackFile.empty())
+    {
+        if (!playback.open(playbackFile))
+            exit(1);
+        if (playback.getHeader().paramsHash != params.hash())
+            std::cerr << "WARNING: replay was recorded with different params\n";
+        nplayers = playback.getHeader().numPlayers;
+        if (nplayers > MAX_LOCAL_PLAYERS)
+        {
+            std::cerr << "Replay has too many players\n";
+            exit(1);
+        }
+    }
+    if (netplay)
+    {
+        if (!transport.open(netplayPort, netplayHost.c_str(), netplayRemotePort))
+            exit(1);
+        nplayers = 2;
+    }
+    if (!recordFile.empty() && !recorder.open(recordFile, params.hash(), nplayers, dt))
+        exit(1);
+    if (!traceFile.empty() && !trace_open(traceFile.c_str()))
+        exit(1);
+
     if (!initLibs())
         exit(1);
+    profiler.setEnabled(profile);
 
-    if ((initJoystick(numPlayers)) == 0)
+    if (!playback.isOpen() && (initJoystick(netplay ? 1 : nplayers)) == 0)
     {
         std::cerr << "Unable to initialize Joystick(s)\n";
         exit(1);
@@ -80,21 +201,22 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    // Init game state
-    ParamReader params("params.dat");
-    WORLD_W = params.get("worldWidth");
-    WORLD_H = params.get("worldHeight");
-    for (unsigned i = 0; i < numPlayers; i++)
+    WORLD_W = params.get(P_WORLD_WIDTH);
+    WORLD_H = params.get(P_WORLD_HEIGHT);
+    if (netplay)
     {
-        Fighter *fighter = new Fighter(params, -225.0f+i*150, -100.f, playerColors[i]);
-        fighter->respawn(false);
-        fighters.push_back(fighter);
+        session = new RollbackSession(params, netplayPlayer - 1, &transport,
+                frameDelay, dt);
+        match = session->getMatch();
     }
-    ground = Rectangle(
-            params.get("level.x"),
-            params.get("level.y"),
-            params.get("level.w"),
-            params.get("level.h"));
+    else
+        match = new Match(params, nplayers);
+    // Changing params part way through would make a replay meaningless, or
+    // desync a netplay match, and packed params can't change
+    size_t packedSize;
+    if (!recorder.isOpen() && !playback.isOpen() && !session
+            && !find_asset("params.dat", &packedSize))
+        paramWatcher.start("params.dat");
 
 
 
@@ -112,20 +234,81 @@ int main(int argc, char **argv)
 void mainloop()
 {
     running = true;
+    ParamReader params;
+    float accumulator = 0.0f;
+    double lastTime = get_time();
     while (running)
     {
-        processInput();
-        update();
-        render();
+        profiler.beginFrame();
+        double frameStart = get_time();
+        float frameTime = std::min(float(frameStart - lastTime), MAX_FRAME_TIME);
+        lastTime = frameStart;
+
+        // Run as many fixed updates as have accumulated in real time, or in
+        // fast mode as many as fit in one rendered frame
+        accumulator += frameTime;
+        while (running && (fastMode ?
+                    get_time() - frameStart < MIN_RENDER_TIME : accumulator >= dt))
+        {
+            {
+                ScopedPhase phase(profiler, PHASE_INPUT);
+                TraceScope span(TRACE_INPUT_SPAN);
+                if (paramWatcher.poll(params))
+                    std::cout << "Changed " << match->reloadParams(params) << " params\n";
+                processInput();
+            }
+            if (!running)
+                break;
+            {
+                ScopedPhase phase(profiler, PHASE_UPDATE);
+                if (session)
+                {
+                    // Stalls while waiting for the remote just skip a tick
+                    session->poll();
+                    session->advance(controllers[0]);
+                    if (session->isFinished())
+                        running = false;
+                }
+                else if (!match->update(controllers, dt))
+                    running = false;
+                recordFrame();
+            }
+            accumulator -= dt;
+        }
+        float alpha = fastMode ? 1.0f : accumulator / dt;
+        if (fastMode)
+            accumulator = 0.0f;
+
+        {
+            ScopedPhase phase(profiler, PHASE_RENDER);
+            TraceScope span(TRACE_RENDER_SPAN);
+            profiler.beginGPU();
+            render(alpha, frameTime);
+            profiler.endGPU();
+        }
+        {
+            ScopedPhase phase(profiler, PHASE_SWAP);
+            TraceScope span(TRACE_SWAP_SPAN);
+            SDL_GL_SwapBuffers();
+        }
+        profiler.endFrame();
 
-        SDL_Delay(static_cast<int>(dt * 1000.0));
+        unsigned glCalls = takeGLCallCount();
+        totalGLCalls += glCalls;
+        maxGLCalls = std::max(maxGLCalls, glCalls);
+        renderedFrames++;
+
+        // Don't spin faster than we need to
+        float elapsed = get_time() - frameStart;
+        if (!fastMode && elapsed < MIN_RENDER_TIME)
+            SDL_Delay(static_cast<int>((MIN_RENDER_TIME - elapsed) * 1000.0f));
     }
 }
 
 void processInput()
 {
     // First update controllers / frame
-    for (unsigned i = 0; i < numPlayers; i++)
+    for (unsigned i = 0; i < match->getNumPlayers(); i++)
     {
         updateController(controllers[i]);
     }
@@ -144,7 +327,7 @@ void processInput()
         case SDL_JOYBUTTONUP:
             idx = idx == -1 ? event.jbutton.which : idx;
             controllerEvent(controllers[idx], event);
-
+            break;
         case SDL_KEYDOWN:
             if (event.key.keysym.sym == SDLK_ESCAPE)
                 running = false;
@@ -152,122 +335,99 @@ void processInput()
                 stop_song();
             if (event.key.keysym.sym == SDLK_p)
                 play_song();
+            // Starts profiling, or reports what has been recorded so far
+            if (event.key.keysym.sym == SDLK_t)
+            {
+                if (profiler.isEnabled())
+                    profiler.printReport();
+                else
+                    profiler.setEnabled(true);
+            }
             break;
         case SDL_QUIT:
             running = false;
             break;
         }
     }
+
+    // Replays replace any joystick input
+    if (playback.isOpen() && !playback.nextFrame(controllers))
+        running = false;
 }
 
-void update()
+void recordFrame()
 {
-    int alivePlayers = 0;
-    for (unsigned i = 0; i < numPlayers; i++)
+    if (session)
     {
-        Fighter *fighter = fighters[i];
-        if (fighter->isAlive()) alivePlayers++;
-
-        // Update positions, etc
-        fighter->update(controllers[i], dt);
-
-        // Cache some vals
-        const Attack *attacki = fighter->getAttack();
-        bool fiattack = fighter->hasAttack();
-        // Check for hitbox collisions
-        for (unsigned j = i+1; j < numPlayers; j++)
-        {
-            const Attack *attackj = fighters[j]->getAttack();
-            bool fjattack = fighters[j]->hasAttack();
-
-            // Hitboxes hit each other?
-            if (fiattack && fjattack && attacki->getHitbox().overlaps(attackj->getHitbox()))
-            {
-                // Then go straight to cooldown
-                fighter->attackCollision();
-                fighters[j]->attackCollision();
-
-                // Generate small explosion
-                Rectangle hitboxi = attacki->getHitbox();
-                Rectangle hitboxj = attackj->getHitbox();
-                float x = (hitboxi.x + hitboxj.x) / 2;
-                float y = (hitboxi.y + hitboxj.y) / 2;
-                ExplosionManager::get()->addExplosion(x, y, 0.1f);
-
-                // Cache values
-                fiattack = fighter->hasAttack();
-                attacki = fighter->getAttack();
-                continue;
-            }
-            if (fiattack && fighters[j]->getRectangle().overlaps(attacki->getHitbox()))
-            {
-                // fighter has hit fighters[j]
-                fighters[j]->hitByAttack(fighter, attacki);
-                fighter->hitWithAttack();
-
-                // Cache values
-                fiattack = fighter->hasAttack();
-                attacki = fighter->getAttack();
-            }
-            if (fjattack && fighter->getRectangle().overlaps(attackj->getHitbox()))
-            {
-                // fighter[j] has hit fighter
-                fighter->hitByAttack(fighters[j], attackj);
-                fighters[j]->hitWithAttack();
-
-                // Cache values
-                fiattack = fighter->hasAttack();
-                attacki = fighter->getAttack();
-            }
-        }
-
-        // Respawn condition
-        if (fighter->getRectangle().y < -WORLD_H/2 * 1.5 || fighter->getRectangle().y > WORLD_H/2 * 1.5
-                || fighter->getRectangle().x < -WORLD_W/2 * 1.5 || fighter->getRectangle().y > WORLD_W/2 * 1.5)
+        // Netplay frames are only recorded once both players' input is known
+        Controller confirmed[2];
+        uint64_t checksum;
+        while (session->readConfirmedFrame(recordedFrames, confirmed, &checksum))
         {
-            fighter->respawn(true);
-            break;
+            recorder.addFrame(confirmed, checksum);
+            if (recorder.wantsKeyframe()
+                    && session->readConfirmedState(recordedFrames, keyframe))
+                recorder.addKeyframe(keyframe);
+            recordedFrames++;
         }
-        // Ground check
-        fighter->collisionWithGround(ground,
-                fighter->getRectangle().overlaps(ground));
+        return;
     }
+    if (!recorder.isOpen() && !playback.isOpen())
+        return;
 
-    // End the game when no one is left
-    if (alivePlayers <= 0)
-        running = false;
+    uint64_t checksum = match->checksum();
+    recorder.addFrame(controllers, checksum);
+    if (recorder.wantsKeyframe())
+    {
+        match->saveSnapshot(keyframe);
+        recorder.addKeyframe(keyframe);
+    }
+    recordedFrames++;
+    uint64_t recorded;
+    if (!playbackDesynced && playback.readChecksum(playback.tell() - 1, &recorded)
+            && recorded != checksum)
+    {
+        std::cerr << "Replay desynced at frame " << playback.tell() - 1 << '\n';
+        playbackDesynced = true;
+    }
 }
 
-void render()
+void render(float alpha, float frameTime)
 {
     // Start with a blank slate
     glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
     glClear( GL_COLOR_BUFFER_BIT );
 
     // Draw the background
-    glm::mat4 backtrans = glm::scale(glm::mat4(1.0f), glm::vec3(1500.0f, 750.0f, 1.0f));
-    renderTexturedRectangle(backtrans, backgroundTex);
+    renderTexturedRectangle(glm::vec2(0.0f), glm::vec2(1500.0f, 750.0f),
+            backgroundTex);
 
     // Draw the land
-    glm::mat4 transform = glm::scale(
-            glm::translate(glm::mat4(1.0f), glm::vec3(ground.x, ground.y, 0.0)),
-            glm::vec3(ground.w, ground.h, 1.0f));
-    renderRectangle(transform, groundColor);
+    const Rectangle &ground = match->getGround();
+    renderRectangle(glm::vec2(ground.x, ground.y), glm::vec2(ground.w, ground.h),
+            groundColor);
 
     // Draw the fighters
-    for (unsigned i = 0; i < numPlayers; i++)
-        fighters[i]->render(dt);
+    for (unsigned i = 0; i < match->getNumPlayers(); i++)
+        match->getFighter(i)->render(frameTime, alpha);
 
     // Draw any explosions
-    ExplosionManager::get()->render(dt);
+    match->getExplosions()->render();
 
-    //
-    // Render the overlay interface (HUD)
-    //
+    // Draw the HUD
+    renderHUD(ground);
+
+    // Finish, the caller swaps buffers
+    flushRectangles();
+}
 
-    for (unsigned i = 0; i < numPlayers; i++)
+// Render the overlay interface, lives and damage under the ground
+void renderHUD(const Rectangle &ground)
+{
+    TraceScope span(TRACE_HUD_SPAN);
+    for (unsigned i = 0; i < match->getNumPlayers(); i++)
     {
-        int lives = fighters[i]->getLives();
+        int lives = match->getFighter(i)->getLives();
         glm::vec2 life_area(-225.0f - 10 + 150*i, ground.y + 15);
         // 10unit border
         // 10unit squares
@@ -275,12 +435,7 @@ void render()
         // Draw life counts first
         for (int j = 0; j < lives; j++)
         {
-            glm::mat4 transform = glm::scale(
-                    glm::translate(
-                        glm::mat4(1.0f),
-                        glm::vec3(life_area.x, life_area.y, 0.0f)),
-                    glm::vec3(10, 10, 1.0));
-            renderRectangle(transform, playerColors[i]);
+            renderRectangle(life_area, glm::vec2(10, 10), playerColors[i]);
 
             if (j % 2 == 0)
                 life_area.x += 20;
@@ -295,42 +450,27 @@ void render()
         // Draw damage bars
         // First, render a black background rect
         glm::vec2 damageBarMidpoint(-225.0f + 150*i, ground.y - 25);
-        glm::mat4 transform = glm::scale(
-                    glm::translate(
-                        glm::mat4(1.0f),
-                        glm::vec3(damageBarMidpoint.x, damageBarMidpoint.y, 0.0f)),
-                    glm::vec3(100, 20, 1.0));
-        renderRectangle(transform, glm::vec3(0, 0, 0));
+        glm::vec2 damageBarSize(100, 20);
+        renderRectangle(damageBarMidpoint, damageBarSize, glm::vec3(0, 0, 0));
 
         float maxDamage = 100;
 
-        float damageRatio = fighters[i]->getDamage() / maxDamage;
+        float damageRatio = match->getFighter(i)->getDamage() / maxDamage;
         float xscalefact = 0.9f * std::min(1.0f, damageRatio - floorf(damageRatio));
         float darkeningFactor = 0.60;
 
         // Draw the last color bar and then draw on top of it
         if (damageRatio >= 1.0f)
         {
-            transform = glm::scale(
-                    glm::translate(
-                        transform,
-                        glm::vec3(0.0f)), //glm::vec3(-.4 * .5 * xscalefact, 0.0f, 0.0f)),
-                glm::vec3( 0.9f, 0.9f, 0.0f));
-            renderRectangle(transform, playerColors[i] * powf(darkeningFactor, floorf(damageRatio - 1)));
+            damageBarSize *= glm::vec2(0.9f, 0.9f);
+            renderRectangle(damageBarMidpoint, damageBarSize,
+                    playerColors[i] * powf(darkeningFactor, floorf(damageRatio - 1)));
         }
        
         // Now fill it in with a colored bar
-        transform = glm::scale(
-                glm::translate(
-                    transform,
-                    glm::vec3(0.0f)), //glm::vec3(-.4 * .5 * xscalefact, 0.0f, 0.0f)),
-                glm::vec3( xscalefact, 0.9f, 0.0f));
-        renderRectangle(transform, playerColors[i] * powf(darkeningFactor, floorf(damageRatio)));
+        renderRectangle(damageBarMidpoint, damageBarSize * glm::vec2(xscalefact, 0.9f),
+                playerColors[i] * powf(darkeningFactor, floorf(damageRatio)));
     }
-
-
-    // Finish
-    SDL_GL_SwapBuffers();
 }
 
 int initJoystick(unsigned numPlayers)
@@ -360,16 +500,50 @@ int initGraphics()
     // Set the viewport
     glViewport(0, 0, SCREEN_W, SCREEN_H);
 
-    initGLUtils(perspectiveTransform);
-
-    backgroundTex = make_texture("back003.tga");
+    // Read and decode everything in parallel, sounds too so fighters find
+    // them already loaded
+    ThreadPool pool;
+    AssetLoader assets(&pool);
+    GLuint program = 0, texProgram = 0;
+    assets.loadProgram(&program, "bbox.v.glsl", "bbox.f.glsl");
+    assets.loadProgram(&texProgram, "texbox.v.glsl", "texbox.f.glsl");
+    assets.loadTexture(&backgroundTex, "back003.tga");
+    std::vector<const char *> sounds;
+    Fighter::getSoundFiles(sounds);
+    for (unsigned i = 0; i < sounds.size(); i++)
+        assets.loadSound(sounds[i]);
+
+    bool ok = assets.finish();
+    assets.printReport();
+    if (!ok)
+        return 0;
 
-    return 1;
+    return initGLUtils(perspectiveTransform, program, texProgram);
 }
 
 void cleanup()
 {
     std::cout << "Quiting nicely\n";
+    if (renderedFrames)
+        std::cout << "GL calls per frame: " << totalGLCalls / renderedFrames
+            << " average, " << maxGLCalls << " max\n";
+    if (profiler.isEnabled())
+        profiler.printReport();
+    paramWatcher.stop();
+    stop_audio();
+    if (session)
+    {
+        const RollbackStats &stats = session->getStats();
+        std::cout << "Netplay: " << stats.rollbacks << " rollbacks, "
+            << stats.resimulatedTicks << " ticks re-simulated, max depth "
+            << stats.maxDepth << ", " << stats.stalls << " stalls\n";
+        delete session;
+    }
+    else
+        delete match;
+    transport.close();
+    trace_close();
+    cleanGLUtils();
     SDL_JoystickClose(0);
     SDL_Quit();
 }
@@ -478,5 +652,7 @@ int initLibs()
 
     SDL_WM_SetCaption("Geometry Smash 0.2", "geosmash");
 
+    start_audio();
+
     return 1;
 }
@@ -0,0 +1,345 @@
+#include "match.h"
+#include "ParamReader.h"
+#include "trace.h"
+#include "hash.h"
+#include <cstring>
+#include <cstdio>
+
+const glm::vec3 playerColors[MAX_PLAYERS] =
+{
+    glm::vec3(0.2, 0.2, 0.8),
+    glm::vec3(0.2, 0.8, 0.2),
+    glm::vec3(0.8, 0.2, 0.2),
+    glm::vec3(0.8, 0.8, 0.2),
+    glm::vec3(0.8, 0.2, 0.8),
+    glm::vec3(0.2, 0.8, 0.8),
+    glm::vec3(0.9, 0.5, 0.1),
+    glm::vec3(0.5, 0.2, 0.9),
+    glm::vec3(0.5, 0.9, 0.2),
+    glm::vec3(0.9, 0.2, 0.5),
+    glm::vec3(0.2, 0.5, 0.9),
+    glm::vec3(0.9, 0.9, 0.9),
+    glm::vec3(0.4, 0.4, 0.4),
+    glm::vec3(0.6, 0.4, 0.2),
+    glm::vec3(0.2, 0.4, 0.2),
+    glm::vec3(0.4, 0.1, 0.1)
+};
+
+Match::Match(const ParamReader &params, unsigned nplayers) :
+    params_(params),
+    ground_(params.get(P_LEVEL_X), params.get(P_LEVEL_Y),
+            params.get(P_LEVEL_W), params.get(P_LEVEL_H)),
+    worldW_(params.get(P_WORLD_WIDTH)),
+    worldH_(params.get(P_WORLD_HEIGHT))
+{
+    assert(nplayers > 0 && nplayers <= MAX_PLAYERS);
+
+    // Unused players' slots are hashed in snapshots too
+    memset(&result_, 0, sizeof(result_));
+    result_.numPlayers = nplayers;
+    result_.ticks = 0;
+    result_.winner = -1;
+    for (unsigned i = 0; i < nplayers; i++)
+    {
+        // Past the first four, players spawn in between them
+        Fighter *fighter = new Fighter(params, -225.0f + (i % 4) * 150 + (i / 4) * 37.5f,
+                -100.f, playerColors[i], &explosions_, i);
+        fighter->respawn(false);
+        fighters_.push_back(fighter);
+
+        lastHitBy_[i] = -1;
+        result_.lives[i] = fighter->getLives();
+        result_.deaths[i] = 0;
+        result_.kos[i] = 0;
+        result_.damageDealt[i] = 0.0f;
+        result_.damageTaken[i] = 0.0f;
+    }
+}
+
+unsigned Match::reloadParams(const ParamReader &params)
+{
+    bool changed[NUM_PARAMS];
+    unsigned nchanged = 0;
+    for (unsigned i = 0; i < NUM_PARAMS; i++)
+    {
+        changed[i] = params.get((ParamID) i) != params_.get((ParamID) i);
+        if (changed[i])
+            nchanged++;
+    }
+    params_ = params;
+    if (nchanged == 0)
+        return 0;
+
+    ground_ = Rectangle(params.get(P_LEVEL_X), params.get(P_LEVEL_Y),
+            params.get(P_LEVEL_W), params.get(P_LEVEL_H));
+    worldW_ = params.get(P_WORLD_WIDTH);
+    worldH_ = params.get(P_WORLD_HEIGHT);
+    for (unsigned i = 0; i < fighters_.size(); i++)
+        fighters_[i]->reloadParams(params, changed);
+    return nchanged;
+}
+
+Match::~Match()
+{
+    for (unsigned i = 0; i < fighters_.size(); i++)
+        delete fighters_[i];
+}
+
+unsigned Match::getNumPlayers() const
+{
+    return fighters_.size();
+}
+
+Fighter* Match::getFighter(unsigned i)
+{
+    return fighters_[i];
+}
+
+const Rectangle& Match::getGround() const
+{
+    return ground_;
+}
+
+ExplosionManager* Match::getExplosions()
+{
+    return &explosions_;
+}
+
+const MatchResult& Match::getResult() const
+{
+    return result_;
+}
+
+void Match::saveSnapshot(MatchSnapshot &snapshot) const
+{
+    snapshot.numPlayers = fighters_.size();
+    for (unsigned i = 0; i < fighters_.size(); i++)
+    {
+        fighters_[i]->save(snapshot.fighters[i]);
+        snapshot.lastHitBy[i] = lastHitBy_[i];
+    }
+    snapshot.result = result_;
+    explosions_.save(snapshot.particles);
+}
+
+void Match::restoreSnapshot(const MatchSnapshot &snapshot)
+{
+    assert(snapshot.numPlayers == fighters_.size());
+    for (unsigned i = 0; i < fighters_.size(); i++)
+    {
+        fighters_[i]->restore(snapshot.fighters[i]);
+        lastHitBy_[i] = snapshot.lastHitBy[i];
+    }
+    result_ = snapshot.result;
+    explosions_.restore(snapshot.particles);
+}
+
+uint64_t MatchSnapshot::hash() const
+{
+    uint64_t h = hash_bytes(&numPlayers, sizeof(numPlayers));
+    h = hash_bytes(fighters, numPlayers * sizeof(FighterSnapshot), h);
+    h = hash_bytes(lastHitBy, numPlayers * sizeof(int), h);
+    h = hash_bytes(&result, sizeof(result), h);
+    return particles.hash(h);
+}
+
+size_t MatchSnapshot::getSize() const
+{
+    return sizeof(*this) + particles.data.size() * sizeof(float);
+}
+
+void MatchSnapshot::diff(const MatchSnapshot &other,
+        std::vector<std::string> &diffs) const
+{
+    if (numPlayers != other.numPlayers)
+    {
+        diffs.push_back("numPlayers");
+        return;
+    }
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        std::vector<std::string> fighterDiffs;
+        fighters[i].diff(other.fighters[i], fighterDiffs);
+        char player[8];
+        snprintf(player, sizeof(player), "P%u ", i + 1);
+        for (unsigned j = 0; j < fighterDiffs.size(); j++)
+            diffs.push_back(player + fighterDiffs[j]);
+        if (lastHitBy[i] != other.lastHitBy[i])
+            diffs.push_back(player + std::string("lastHitBy"));
+    }
+    if (memcmp(&result, &other.result, sizeof(result)) != 0)
+        diffs.push_back("result");
+    if (particles.hash(0) != other.particles.hash(0))
+        diffs.push_back("particles");
+}
+
+uint64_t Match::checksum() const
+{
+    FighterSnapshot fighter;
+    uint64_t h = HASH_SEED;
+    for (unsigned i = 0; i < fighters_.size(); i++)
+    {
+        fighters_[i]->save(fighter);
+        h = hash_bytes(&fighter, sizeof(fighter), h);
+    }
+    return hash_bytes(lastHitBy_, fighters_.size() * sizeof(int), h);
+}
+
+void Match::knockOut(unsigned i)
+{
+    fighters_[i]->respawn(true);
+    if (trace_enabled(TRACE_EVENTS))
+    {
+        float values[] = { float(lastHitBy_[i]), float(fighters_[i]->getLives()) };
+        trace_record(TRACE_KO, i, values, 2);
+    }
+
+    result_.deaths[i]++;
+    if (lastHitBy_[i] >= 0)
+        result_.kos[lastHitBy_[i]]++;
+    lastHitBy_[i] = -1;
+}
+
+bool Match::update(const Controller *controllers, float dt)
+{
+    TraceScope span(TRACE_MATCH_UPDATE_SPAN);
+    const unsigned numPlayers = fighters_.size();
+
+    // Update positions, etc
+    for (unsigned i = 0; i < numPlayers; i++)
+        fighters_[i]->update(controllers[i], dt);
+
+    resolveCollisions();
+    explosions_.update(dt);
+    result_.ticks++;
+
+    // End the game when one player is left, or no one in a single player game
+    int alivePlayers = 0;
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        result_.lives[i] = std::max(0, fighters_[i]->getLives());
+        if (fighters_[i]->isAlive())
+        {
+            alivePlayers++;
+            result_.winner = i;
+        }
+    }
+    if (alivePlayers != 1)
+        result_.winner = -1;
+
+    return numPlayers == 1 ? alivePlayers > 0 : alivePlayers > 1;
+}
+
+void Match::resolveCollisions()
+{
+    TraceScope span(TRACE_COLLISION_SPAN);
+    const unsigned numPlayers = fighters_.size();
+
+    // Collect this tick's boxes, each hitbox is only computed once
+    collisions_.clear();
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        const Fighter *fighter = fighters_[i];
+        if (!fighter->isAlive())
+            continue;
+        collisions_.addHurtbox(i, fighter->getRectangle());
+        if (fighter->hasAttack())
+            collisions_.addHitbox(i, fighter->getAttackHitbox());
+    }
+
+    // Work out every outcome from the state before any contact is applied,
+    // so results don't depend on the order the fighters are in.  An attack
+    // that clashes with another hits no one this tick.
+    clashed_.assign(numPlayers, false);
+    connected_.assign(numPlayers, false);
+    const std::vector<Contact> &contacts = collisions_.findContacts();
+    for (unsigned c = 0; c < contacts.size(); c++)
+    {
+        const Contact &contact = contacts[c];
+        if (contact.type == ATTACK_CLASH)
+        {
+            clashed_[contact.a] = clashed_[contact.b] = true;
+            // Generate small explosion
+            explosions_.addExplosion(contact.x, contact.y, 0.1f);
+        }
+    }
+
+    // Hits are grouped by the fighter they land on: count them, then each
+    // fighter's run starts after the ones before it
+    hitStart_.assign(numPlayers + 1, 0);
+    hitCount_.assign(numPlayers, 0);
+    for (unsigned c = 0; c < contacts.size(); c++)
+        if (contacts[c].type == ATTACK_HIT && !clashed_[contacts[c].a])
+            hitStart_[contacts[c].b + 1]++;
+    for (unsigned i = 0; i < numPlayers; i++)
+        hitStart_[i + 1] += hitStart_[i];
+    hits_.resize(hitStart_[numPlayers]);
+    hitters_.resize(hitStart_[numPlayers]);
+    for (unsigned c = 0; c < contacts.size(); c++)
+    {
+        const Contact &contact = contacts[c];
+        if (contact.type != ATTACK_HIT || clashed_[contact.a])
+            continue;
+        const Fighter *attacker = fighters_[contact.a];
+        const Fighter *target = fighters_[contact.b];
+        Hit hit = attacker->getAttackHit(target);
+        unsigned slot = hitStart_[contact.b] + hitCount_[contact.b]++;
+        hitters_[slot] = contact.a;
+        hits_[slot] = hit;
+        connected_[contact.a] = true;
+
+        result_.damageDealt[contact.a] += hit.damage;
+        result_.damageTaken[contact.b] += hit.damage;
+        if (trace_enabled(TRACE_EVENTS))
+        {
+            float values[] = { float(contact.a), hit.damage, hit.stun };
+            trace_record(TRACE_HIT, contact.b, values, 3);
+        }
+    }
+
+    // Then apply them all
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        // Clashing attacks go straight to cooldown
+        if (clashed_[i])
+            fighters_[i]->attackCollision();
+        if (connected_[i])
+            fighters_[i]->hitWithAttack();
+    }
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        const unsigned start = hitStart_[i], nhits = hitCount_[i];
+        if (nhits == 0)
+            continue;
+        fighters_[i]->hitByAttack(&hits_[start], nhits);
+
+        // The hardest hit gets credit for a KO
+        unsigned best = start;
+        for (unsigned h = start + 1; h < start + nhits; h++)
+            if (hits_[h].damage > hits_[best].damage)
+                best = h;
+        lastHitBy_[i] = hitters_[best];
+    }
+
+    // Every fighter gets the same checks, a knock out doesn't stop the
+    // fighters after it being checked
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        Fighter *fighter = fighters_[i];
+
+        // Dead fighters are parked far away, don't keep knocking them out
+        if (!fighter->isAlive())
+            continue;
+
+        // Respawn condition
+        if (fighter->getRectangle().y < -worldH_/2 * 1.5 || fighter->getRectangle().y > worldH_/2 * 1.5
+                || fighter->getRectangle().x < -worldW_/2 * 1.5 || fighter->getRectangle().x > worldW_/2 * 1.5)
+        {
+            knockOut(i);
+            continue;
+        }
+        // Ground check
+        fighter->collisionWithGround(ground_,
+                fighter->getRectangle().overlaps(ground_));
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include "Fighter.h"
+#include "explosion.h"
+#include "collision.h"
+#include "ParamReader.h"
+
+/*
+ * All of the state of one game.  Nothing in here touches windowing, audio or
+ * the GPU, and matches share no state, so many can run at once on different
+ * threads.
+ */
+
+// Big free-for-alls are for ssb-sim, fixed size per player arrays stay small
+static const unsigned MAX_PLAYERS = 16;
+
+extern const glm::vec3 playerColors[MAX_PLAYERS];
+
+// Statistics collected over a match
+struct MatchResult
+{
+    unsigned numPlayers;
+    // Number of updates the match ran for
+    unsigned ticks;
+    // Index of the last player standing, or -1
+    int winner;
+
+    // Lives each player had left at the end
+    int lives[MAX_PLAYERS];
+    // Times each player was knocked out
+    unsigned deaths[MAX_PLAYERS];
+    // Knock outs credited to each player, for being the last to hit the
+    // fighter that died
+    unsigned kos[MAX_PLAYERS];
+    float damageDealt[MAX_PLAYERS];
+    float damageTaken[MAX_PLAYERS];
+};
+
+// Everything that changes during a match.  Only the first numPlayers fighters
+// are used.  Reusing a snapshot for each save keeps the particles' buffer, so
+// saving doesn't allocate once it has grown.
+struct MatchSnapshot
+{
+    unsigned numPlayers;
+    FighterSnapshot fighters[MAX_PLAYERS];
+    int lastHitBy[MAX_PLAYERS];
+    MatchResult result;
+    ParticleSnapshot particles;
+
+    // Covers only the parts in use, so equal states hash the same
+    uint64_t hash() const;
+    // Bytes of state held, including the particles
+    size_t getSize() const;
+    // Adds a line to diffs for each field that differs from other, with
+    // fighter fields prefixed by the player
+    void diff(const MatchSnapshot &other, std::vector<std::string> &diffs) const;
+};
+
+class Match
+{
+public:
+    Match(const ParamReader &params, unsigned nplayers);
+    ~Match();
+
+    // Steps the simulation by dt, controllers must have one entry per
+    // player.  Returns false once the match is over.
+    bool update(const Controller *controllers, float dt);
+    // Switches the match to new params between updates.  Returns the number
+    // of params that changed.
+    unsigned reloadParams(const ParamReader &params);
+
+    unsigned getNumPlayers() const;
+    Fighter* getFighter(unsigned i);
+    const Rectangle& getGround() const;
+    ExplosionManager* getExplosions();
+    const MatchResult& getResult() const;
+
+    // Hash of the fighters and their attacks, cheap enough to take every
+    // tick.  Two matches that checksum the same can only differ in
+    // particles and stats.
+    uint64_t checksum() const;
+
+    void saveSnapshot(MatchSnapshot &snapshot) const;
+    // Puts the match back exactly as it was when snapshot was saved.  The
+    // snapshot must be from a match with the same number of players.
+    void restoreSnapshot(const MatchSnapshot &snapshot);
+
+private:
+    // The params the match is currently using
+    ParamReader params_;
+    std::vector<Fighter*> fighters_;
+    Rectangle ground_;
+    float worldW_, worldH_;
+    ExplosionManager explosions_;
+    CollisionSystem collisions_;
+
+    MatchResult result_;
+    // Index of the last player to hit each fighter, or -1
+    int lastHitBy_[MAX_PLAYERS];
+
+    // resolveCollisions' working space, kept so ticks don't allocate.  The
+    // hits on fighter i are hits_[hitStart_[i]] up to hitStart_[i + 1],
+    // with who landed each in hitters_.
+    std::vector<char> clashed_, connected_;
+    std::vector<unsigned> hitStart_, hitCount_;
+    std::vector<Hit> hits_;
+    std::vector<unsigned> hitters_;
+
+    // Removes a life from fighter i and credits the KO
+    void knockOut(unsigned i);
+    // Finds and applies this tick's hits, knock outs and ground contact
+    void resolveCollisions();
+
+    Match(const Match &);
+};
@@ -0,0 +1,39 @@
+#include "audio.h"
+
+/*
+ * No-op audio backend, used by the headless simulation.
+ */
+
+void start_audio() { }
+void stop_audio() { }
+
+void start_song(const char *filename) { }
+void play_song() { }
+void stop_song() { }
+void set_music_volume(float volume) { }
+void set_sound_volume(float volume) { }
+
+int load_sound(const char *filename)
+{
+    return -1;
+}
+
+int load_sound_memory(const char *filename, const void *data, size_t size)
+{
+    return -1;
+}
+
+DecodedSound *decode_sound(const char *filename, const void *data, size_t size)
+{
+    return NULL;
+}
+
+int add_decoded_sound(const char *filename, DecodedSound *sound)
+{
+    return -1;
+}
+
+void free_decoded_sound(DecodedSound *sound) { }
+
+void play_sound(int id) { }
+void set_sounds_muted(bool muted) { }
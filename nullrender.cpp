@@ -0,0 +1,10 @@
+#include "render.h"
+
+/*
+ * No-op rendering backend, used by the headless simulation.
+ */
+
+void renderRectangle(const glm::vec2 &center, const glm::vec2 &size,
+        const glm::vec3 &color, float rotation)
+{
+}
@@ -0,0 +1,24 @@
+#include <iostream>
+#include "archive.h"
+
+/*
+ * Packs assets into one archive that ssb and ssb-sim map at startup.  Files
+ * are packed under the paths given, which is what the game looks them up by.
+ */
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "usage: " << argv[0] << " ARCHIVE FILE...\n";
+        return 1;
+    }
+    if (!AssetArchive::pack(argv[1], argv + 2, argc - 2))
+        return 1;
+
+    AssetArchive archive;
+    if (!archive.open(argv[1]))
+        return 1;
+    std::cout << "Packed " << argc - 2 << " files into " << argv[1] << '\n';
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "paramwatcher.h"
+#include <iostream>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+
+// How long the watch thread waits for events before checking running_
+static const int WATCH_TIMEOUT_MS = 100;
+
+ParamWatcher::ParamWatcher() :
+    fd_(-1), running_(false), ready_(false)
+{}
+
+ParamWatcher::~ParamWatcher()
+{
+    stop();
+}
+
+bool ParamWatcher::start(const std::string &filename)
+{
+    stop();
+
+    std::string dir = ".";
+    basename_ = filename;
+    size_t slash = filename.rfind('/');
+    if (slash != std::string::npos)
+    {
+        dir = filename.substr(0, slash + 1);
+        basename_ = filename.substr(slash + 1);
+    }
+    filename_ = filename;
+
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0)
+    {
+        std::cerr << "Unable to init inotify to watch " << filename << '\n';
+        return false;
+    }
+    if (inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        std::cerr << "Unable to watch " << dir << " for changes to " << filename << '\n';
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    running_ = true;
+    thread_ = std::thread(&ParamWatcher::watch, this);
+    return true;
+}
+
+void ParamWatcher::stop()
+{
+    if (!running_)
+        return;
+    running_ = false;
+    thread_.join();
+    close(fd_);
+    fd_ = -1;
+}
+
+bool ParamWatcher::poll(ParamReader &params)
+{
+    // Cheap enough to call every tick, the lock is only taken after a reload
+    if (!ready_.load(std::memory_order_acquire))
+        return false;
+    std::lock_guard<std::mutex> guard(lock_);
+    params = pending_;
+    ready_.store(false, std::memory_order_relaxed);
+    return true;
+}
+
+void ParamWatcher::watch()
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    while (running_)
+    {
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLIN;
+        if (::poll(&pfd, 1, WATCH_TIMEOUT_MS) <= 0)
+            continue;
+
+        // Drain every queued event, one save can produce several
+        bool changed = false;
+        ssize_t len;
+        while ((len = read(fd_, buf, sizeof(buf))) > 0)
+        {
+            for (char *p = buf; p < buf + len; )
+            {
+                const struct inotify_event *event = (const struct inotify_event *) p;
+                if (event->len && basename_ == event->name)
+                    changed = true;
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (!changed)
+            continue;
+
+        // Errors have been printed, keep the old params until it's fixed
+        ParamReader params(filename_.c_str());
+        if (!params.isValid())
+            continue;
+
+        std::lock_guard<std::mutex> guard(lock_);
+        pending_ = params;
+        ready_.store(true, std::memory_order_release);
+        std::cout << "Reloaded " << filename_ << '\n';
+    }
+}
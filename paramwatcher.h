@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "ParamReader.h"
+
+/*
+ * Watches a params file with inotify and re-reads it on a background thread
+ * whenever it is saved.  The game picks up the new values with poll() between
+ * ticks, so params never change in the middle of an update.
+ */
+class ParamWatcher
+{
+public:
+    ParamWatcher();
+    ~ParamWatcher();
+
+    // Starts watching filename, returns false if it can't be watched
+    bool start(const std::string &filename);
+    void stop();
+
+    // If the file has been reloaded since the last call, and every param was
+    // valid, copies the new values into params and returns true
+    bool poll(ParamReader &params);
+
+private:
+    std::string filename_;
+    // Name of the file within its directory, which is what is watched so
+    // editors that save by renaming over the file are noticed too
+    std::string basename_;
+    int fd_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    // Set when pending_ holds params the game hasn't picked up yet
+    std::atomic<bool> ready_;
+    std::mutex lock_;
+    ParamReader pending_;
+
+    void watch();
+
+    ParamWatcher(const ParamWatcher &);
+};
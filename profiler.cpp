@@ -0,0 +1,140 @@
+#include "profiler.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+static const char *phaseNames[] =
+{
+    "input", "update", "render", "swap", "gpu", "frame"
+};
+// Fails to compile if the names and FramePhase get out of step
+typedef char phaseNamesCheck[
+    sizeof(phaseNames) / sizeof(phaseNames[0]) == NUM_PHASES ? 1 : -1];
+
+FrameProfiler::FrameProfiler() :
+    enabled_(false),
+    frameStarted_(false),
+    frame_(0),
+    numFrames_(0),
+    frameStart_(0.0),
+    gpuTiming_(false),
+    nextQuery_(0),
+    queryActive_(false)
+{
+    memset(times_, 0, sizeof(times_));
+    memset(queries_, 0, sizeof(queries_));
+    memset(queryFrames_, 0, sizeof(queryFrames_));
+    memset(queryPending_, 0, sizeof(queryPending_));
+}
+
+void FrameProfiler::setEnabled(bool enabled)
+{
+    if (enabled && !queries_[0] && (GLEW_VERSION_3_3 || GLEW_ARB_timer_query))
+    {
+        glGenQueries(NUM_QUERIES, queries_);
+        gpuTiming_ = true;
+    }
+    enabled_ = enabled;
+}
+
+void FrameProfiler::beginFrame()
+{
+    if (!enabled_)
+        return;
+    float *times = frameTimes(frame_);
+    for (unsigned i = 0; i < NUM_PHASES; i++)
+        times[i] = 0.0f;
+    times[PHASE_GPU] = -1.0f;
+    frameStart_ = get_time();
+    frameStarted_ = true;
+}
+
+void FrameProfiler::endFrame()
+{
+    if (!frameStarted_)
+        return;
+    frameTimes(frame_)[PHASE_FRAME] = get_time() - frameStart_;
+    readQueries();
+    frameStarted_ = false;
+    frame_++;
+    numFrames_ = std::min<unsigned long>(numFrames_ + 1, HISTORY);
+}
+
+void FrameProfiler::add(FramePhase phase, double seconds)
+{
+    if (frameStarted_)
+        frameTimes(frame_)[phase] += seconds;
+}
+
+void FrameProfiler::beginGPU()
+{
+    // Skip this frame if the GPU is so far behind every query is in use
+    if (!frameStarted_ || !gpuTiming_ || queryPending_[nextQuery_])
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, queries_[nextQuery_]);
+    queryActive_ = true;
+}
+
+void FrameProfiler::endGPU()
+{
+    if (!queryActive_)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    queryFrames_[nextQuery_] = frame_;
+    queryPending_[nextQuery_] = true;
+    nextQuery_ = (nextQuery_ + 1) % NUM_QUERIES;
+    queryActive_ = false;
+}
+
+void FrameProfiler::readQueries()
+{
+    for (unsigned i = 0; i < NUM_QUERIES; i++)
+    {
+        if (!queryPending_[i])
+            continue;
+        GLint available;
+        glGetQueryObjectiv(queries_[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(queries_[i], GL_QUERY_RESULT, &elapsed);
+        queryPending_[i] = false;
+        // The frame may have been overwritten already
+        if (frame_ - queryFrames_[i] < HISTORY)
+            frameTimes(queryFrames_[i])[PHASE_GPU] = elapsed * 1e-9;
+    }
+}
+
+void FrameProfiler::printReport() const
+{
+    std::cout << "Frame timing over the last " << numFrames_ << " frames (ms)\n";
+    std::cout << std::fixed << std::setprecision(3);
+    std::vector<float> samples;
+    for (unsigned phase = 0; phase < NUM_PHASES; phase++)
+    {
+        samples.clear();
+        for (unsigned long i = 0; i < numFrames_; i++)
+        {
+            float t = times_[(frame_ - 1 - i) % HISTORY][phase];
+            if (t >= 0.0f)
+                samples.push_back(t * 1000.0f);
+        }
+        std::cout << "  " << std::left << std::setw(8) << phaseNames[phase]
+            << std::right;
+        if (samples.empty())
+        {
+            std::cout << " no samples\n";
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        unsigned n = samples.size() - 1;
+        std::cout << " p50 " << std::setw(8) << samples[n / 2]
+            << "  p95 " << std::setw(8) << samples[n * 95 / 100]
+            << "  p99 " << std::setw(8) << samples[n * 99 / 100]
+            << "  max " << std::setw(8) << samples[n] << '\n';
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
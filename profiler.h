@@ -0,0 +1,90 @@
+#pragma once
+#include <GL/glew.h>
+#include "timer.h"
+
+// Parts of a frame that are timed separately
+enum FramePhase
+{
+    PHASE_INPUT,
+    PHASE_UPDATE,
+    PHASE_RENDER,
+    PHASE_SWAP,
+    PHASE_GPU,
+    PHASE_FRAME,
+    NUM_PHASES
+};
+
+/*
+ * Records how long each phase of the last HISTORY frames took.  Input and
+ * update can run several times in one frame, their times are summed.  GPU
+ * time comes from timer queries read back a few frames later, so the CPU
+ * never waits on them.  While disabled every call just checks a flag.
+ */
+class FrameProfiler
+{
+public:
+    FrameProfiler();
+
+    // Needs a GL context, GPU times are only recorded if timer queries are
+    // supported.  Enabling mid-frame starts recording from the next
+    // beginFrame.
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled_; }
+
+    void beginFrame();
+    void endFrame();
+    void add(FramePhase phase, double seconds);
+    // Brackets the GL commands to time on the GPU, can't be nested
+    void beginGPU();
+    void endGPU();
+
+    // Prints p50, p95, p99 and max of each phase over the recorded frames
+    void printReport() const;
+
+private:
+    static const unsigned HISTORY = 1024;
+    static const unsigned NUM_QUERIES = 4;
+
+    // Stores the results of any queries the GPU has finished
+    void readQueries();
+    float *frameTimes(unsigned long frame) { return times_[frame % HISTORY]; }
+
+    bool enabled_;
+    // Between a beginFrame and endFrame made while enabled
+    bool frameStarted_;
+    unsigned long frame_;
+    unsigned long numFrames_;
+    double frameStart_;
+    // Seconds, GPU times are negative until their query is read
+    float times_[HISTORY][NUM_PHASES];
+
+    bool gpuTiming_;
+    GLuint queries_[NUM_QUERIES];
+    // Frame each query measured, and whether it is waiting to be read
+    unsigned long queryFrames_[NUM_QUERIES];
+    bool queryPending_[NUM_QUERIES];
+    unsigned nextQuery_;
+    bool queryActive_;
+};
+
+// Adds the time until it goes out of scope to a phase of the current frame
+class ScopedPhase
+{
+public:
+    ScopedPhase(FrameProfiler &profiler, FramePhase phase) :
+        profiler_(profiler), phase_(phase), enabled_(profiler.isEnabled()),
+        start_(enabled_ ? get_time() : 0.0)
+    {
+    }
+    ~ScopedPhase()
+    {
+        if (enabled_)
+            profiler_.add(phase_, get_time() - start_);
+    }
+
+private:
+    FrameProfiler &profiler_;
+    FramePhase phase_;
+    bool enabled_;
+    double start_;
+};
@@ -0,0 +1,11 @@
+#pragma once
+#include <glm/glm.hpp>
+
+/*
+ * Drawing functions used by the game objects.  glutils.cpp implements these
+ * with OpenGL, nullrender.cpp provides a no-op backend for headless builds.
+ */
+
+// Rotation is in radians, counterclockwise about the center
+void renderRectangle(const glm::vec2 &center, const glm::vec2 &size,
+        const glm::vec3 &color, float rotation = 0.0f);
@@ -0,0 +1,372 @@
+#include "replay.h"
+#include <iostream>
+#include <cstring>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char REPLAY_MAGIC[4] = { 'G', 'S', 'R', 'P' };
+static const uint32_t REPLAY_VERSION = 3;
+// Oldest version that can still be played
+static const uint32_t REPLAY_MIN_VERSION = 1;
+
+// A keyframe is a flag saying whether it was recorded, then numPlayers
+// FighterSnapshots and numPlayers lastHitBy
+static size_t keyframeSize(unsigned numPlayers)
+{
+    return sizeof(uint32_t) + numPlayers * (sizeof(FighterSnapshot) + sizeof(int32_t));
+}
+
+// Button bits in the last byte of a controller record
+enum
+{
+    BUTTON_A = 1 << 0, BUTTON_B = 1 << 1, BUTTON_C = 1 << 2, BUTTON_JUMP = 1 << 3,
+    PRESS_A = 1 << 4, PRESS_B = 1 << 5, PRESS_C = 1 << 6, PRESS_JUMP = 1 << 7
+};
+
+void encodeController(const Controller &c, unsigned char *out)
+{
+    memcpy(out, &c.joyx, sizeof(float));
+    memcpy(out + 4, &c.joyy, sizeof(float));
+    memcpy(out + 8, &c.joyxv, sizeof(float));
+    memcpy(out + 12, &c.joyyv, sizeof(float));
+    out[16] = (c.buttona ? BUTTON_A : 0) | (c.buttonb ? BUTTON_B : 0)
+        | (c.buttonc ? BUTTON_C : 0) | (c.jumpbutton ? BUTTON_JUMP : 0)
+        | (c.pressa ? PRESS_A : 0) | (c.pressb ? PRESS_B : 0)
+        | (c.pressc ? PRESS_C : 0) | (c.pressjump ? PRESS_JUMP : 0);
+}
+
+void decodeController(const unsigned char *in, Controller &c)
+{
+    memcpy(&c.joyx, in, sizeof(float));
+    memcpy(&c.joyy, in + 4, sizeof(float));
+    memcpy(&c.joyxv, in + 8, sizeof(float));
+    memcpy(&c.joyyv, in + 12, sizeof(float));
+    unsigned char buttons = in[16];
+    c.buttona = (buttons & BUTTON_A) != 0;
+    c.buttonb = (buttons & BUTTON_B) != 0;
+    c.buttonc = (buttons & BUTTON_C) != 0;
+    c.jumpbutton = (buttons & BUTTON_JUMP) != 0;
+    c.pressa = (buttons & PRESS_A) != 0;
+    c.pressb = (buttons & PRESS_B) != 0;
+    c.pressc = (buttons & PRESS_C) != 0;
+    c.pressjump = (buttons & PRESS_JUMP) != 0;
+}
+
+// ----------------------------------------------------------------------------
+// ReplayWriter class methods
+// ----------------------------------------------------------------------------
+
+ReplayWriter::ReplayWriter() :
+    file_(NULL), numPlayers_(0), numFrames_(0), keyframeDue_(false)
+{}
+
+ReplayWriter::~ReplayWriter()
+{
+    close();
+}
+
+bool ReplayWriter::open(const std::string &filename, uint64_t paramsHash,
+        unsigned numPlayers, float dt)
+{
+    close();
+    file_ = fopen(filename.c_str(), "wb");
+    if (!file_)
+    {
+        std::cerr << "Unable to open " << filename << " to record replay\n";
+        return false;
+    }
+
+    ReplayHeader header;
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.paramsHash = paramsHash;
+    header.numPlayers = numPlayers;
+    header.dt = dt;
+    filename_ = filename;
+    if (fwrite(&header, sizeof(header), 1, file_) != 1)
+    {
+        writeFailed();
+        return false;
+    }
+
+    numPlayers_ = numPlayers;
+    numFrames_ = 0;
+    keyframeDue_ = false;
+    record_.resize(numPlayers * REPLAY_CONTROLLER_SIZE + REPLAY_CHECKSUM_SIZE);
+    keyframe_.resize(keyframeSize(numPlayers));
+    return true;
+}
+
+void ReplayWriter::close()
+{
+    // Buffered frames are only written out here, so it can fail too
+    if (file_ && fclose(file_) != 0)
+        std::cerr << "Unable to finish writing replay " << filename_ << '\n';
+    file_ = NULL;
+}
+
+void ReplayWriter::writeFailed()
+{
+    std::cerr << "Unable to write replay " << filename_
+        << ", recording stopped\n";
+    fclose(file_);
+    file_ = NULL;
+}
+
+bool ReplayWriter::isOpen() const
+{
+    return file_ != NULL;
+}
+
+void ReplayWriter::addFrame(const Controller *controllers, uint64_t checksum)
+{
+    if (!file_)
+        return;
+    if (keyframeDue_)
+        writeKeyframe(NULL);
+    if (!file_)
+        return;
+
+    // Written in one go, so a failure never leaves half a record behind
+    // that later frames would be misread against
+    unsigned char *record = &record_[0];
+    for (unsigned i = 0; i < numPlayers_; i++)
+        encodeController(controllers[i], record + i * REPLAY_CONTROLLER_SIZE);
+    memcpy(record + numPlayers_ * REPLAY_CONTROLLER_SIZE, &checksum, REPLAY_CHECKSUM_SIZE);
+    if (fwrite(record, record_.size(), 1, file_) != 1)
+    {
+        writeFailed();
+        return;
+    }
+    numFrames_++;
+    keyframeDue_ = numFrames_ % REPLAY_KEYFRAME_INTERVAL == 0;
+}
+
+bool ReplayWriter::wantsKeyframe() const
+{
+    return file_ && keyframeDue_;
+}
+
+void ReplayWriter::addKeyframe(const MatchSnapshot &snapshot)
+{
+    if (wantsKeyframe())
+        writeKeyframe(&snapshot);
+}
+
+void ReplayWriter::writeKeyframe(const MatchSnapshot *snapshot)
+{
+    keyframeDue_ = false;
+    memset(&keyframe_[0], 0, keyframe_.size());
+    if (snapshot)
+    {
+        assert(snapshot->numPlayers == numPlayers_);
+        unsigned char *out = &keyframe_[0];
+        uint32_t recorded = 1;
+        memcpy(out, &recorded, sizeof(recorded));
+        out += sizeof(recorded);
+        memcpy(out, snapshot->fighters, numPlayers_ * sizeof(FighterSnapshot));
+        out += numPlayers_ * sizeof(FighterSnapshot);
+        for (unsigned i = 0; i < numPlayers_; i++)
+        {
+            int32_t lastHitBy = snapshot->lastHitBy[i];
+            memcpy(out + i * sizeof(lastHitBy), &lastHitBy, sizeof(lastHitBy));
+        }
+    }
+    if (fwrite(&keyframe_[0], keyframe_.size(), 1, file_) != 1)
+        writeFailed();
+}
+
+// ----------------------------------------------------------------------------
+// ReplayReader class methods
+// ----------------------------------------------------------------------------
+
+ReplayReader::ReplayReader() :
+    data_(NULL), size_(0), frameSize_(0), keyframeSize_(0), numFrames_(0), frame_(0)
+{
+    memset(&header_, 0, sizeof(header_));
+}
+
+ReplayReader::~ReplayReader()
+{
+    close();
+}
+
+bool ReplayReader::open(const std::string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Unable to open replay " << filename << '\n';
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(ReplayHeader))
+    {
+        std::cerr << filename << " is not a replay\n";
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "Unable to map replay " << filename << '\n';
+        return false;
+    }
+    data_ = (const unsigned char *) data;
+    size_ = st.st_size;
+
+    memcpy(&header_, data_, sizeof(header_));
+    if (memcmp(header_.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) != 0
+            || header_.version < REPLAY_MIN_VERSION
+            || header_.version > REPLAY_VERSION
+            || header_.numPlayers == 0
+            || header_.numPlayers > MAX_PLAYERS)
+    {
+        std::cerr << filename << " is not a valid replay\n";
+        close();
+        return false;
+    }
+    frameSize_ = header_.numPlayers * REPLAY_CONTROLLER_SIZE;
+    if (header_.version >= 2)
+        frameSize_ += REPLAY_CHECKSUM_SIZE;
+    keyframeSize_ = header_.version >= 3 ? keyframeSize(header_.numPlayers) : 0;
+
+    // Whole groups of frames and their keyframe, then the frames after the
+    // last keyframe.  Recording can stop just before a keyframe.
+    const unsigned groupFrames = keyframeSize_ ? REPLAY_KEYFRAME_INTERVAL : 1;
+    const size_t groupSize = groupFrames * frameSize_ + keyframeSize_;
+    const size_t rest = (size_ - sizeof(header_)) % groupSize;
+    if (rest % frameSize_ != 0 || rest > groupFrames * frameSize_)
+    {
+        std::cerr << filename << " is not a valid replay\n";
+        close();
+        return false;
+    }
+    numFrames_ = (size_ - sizeof(header_)) / groupSize * groupFrames + rest / frameSize_;
+    frame_ = 0;
+
+    // Playback reads front to back
+    madvise(data, size_, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+void ReplayReader::close()
+{
+    if (data_)
+        munmap((void *) data_, size_);
+    data_ = NULL;
+    size_ = 0;
+    numFrames_ = 0;
+    frame_ = 0;
+}
+
+bool ReplayReader::isOpen() const
+{
+    return data_ != NULL;
+}
+
+const ReplayHeader& ReplayReader::getHeader() const
+{
+    return header_;
+}
+
+unsigned ReplayReader::getNumFrames() const
+{
+    return numFrames_;
+}
+
+bool ReplayReader::readFrame(unsigned frame, Controller *controllers) const
+{
+    if (frame >= numFrames_)
+        return false;
+
+    const unsigned char *record = frameRecord(frame);
+    for (unsigned i = 0; i < header_.numPlayers; i++)
+    {
+        decodeController(record, controllers[i]);
+        record += REPLAY_CONTROLLER_SIZE;
+    }
+    return true;
+}
+
+bool ReplayReader::hasChecksums() const
+{
+    return header_.version >= 2;
+}
+
+bool ReplayReader::readChecksum(unsigned frame, uint64_t *checksum) const
+{
+    if (frame >= numFrames_ || !hasChecksums())
+        return false;
+
+    // The checksum ends the record
+    memcpy(checksum, frameRecord(frame) + frameSize_ - REPLAY_CHECKSUM_SIZE,
+            REPLAY_CHECKSUM_SIZE);
+    return true;
+}
+
+bool ReplayReader::hasKeyframe(unsigned frame) const
+{
+    if (!keyframeSize_ || frame >= numFrames_
+            || (frame + 1) % REPLAY_KEYFRAME_INTERVAL != 0)
+        return false;
+    // It follows the frame's record, if recording got that far
+    const unsigned char *keyframe = frameRecord(frame) + frameSize_;
+    if (keyframe + keyframeSize_ > data_ + size_)
+        return false;
+    uint32_t recorded;
+    memcpy(&recorded, keyframe, sizeof(recorded));
+    return recorded != 0;
+}
+
+bool ReplayReader::readKeyframe(unsigned frame, MatchSnapshot &snapshot) const
+{
+    if (!hasKeyframe(frame))
+        return false;
+
+    const unsigned numPlayers = header_.numPlayers;
+    const unsigned char *in = frameRecord(frame) + frameSize_ + sizeof(uint32_t);
+    snapshot.numPlayers = numPlayers;
+    memcpy(snapshot.fighters, in, numPlayers * sizeof(FighterSnapshot));
+    in += numPlayers * sizeof(FighterSnapshot);
+    for (unsigned i = 0; i < numPlayers; i++)
+    {
+        int32_t lastHitBy;
+        memcpy(&lastHitBy, in + i * sizeof(lastHitBy), sizeof(lastHitBy));
+        snapshot.lastHitBy[i] = lastHitBy;
+    }
+    return true;
+}
+
+const unsigned char *ReplayReader::frameRecord(unsigned frame) const
+{
+    size_t offset = sizeof(header_) + frame * frameSize_;
+    if (keyframeSize_)
+        offset += frame / REPLAY_KEYFRAME_INTERVAL * keyframeSize_;
+    return data_ + offset;
+}
+
+void ReplayReader::seek(unsigned frame)
+{
+    frame_ = frame;
+}
+
+unsigned ReplayReader::tell() const
+{
+    return frame_;
+}
+
+bool ReplayReader::nextFrame(Controller *controllers)
+{
+    if (!readFrame(frame_, controllers))
+        return false;
+    frame_++;
+    return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Fighter.h"
+#include "match.h"
+
+/*
+ * Replays record the Controller state of every player for every frame.  The
+ * file is a ReplayHeader followed by fixed size frame records, so any frame
+ * can be found without decoding the ones before it.  A record is each
+ * player's Controller, then from version 2 the Match::checksum() after the
+ * frame was simulated, so playback can tell exactly where it went
+ * differently.  From version 3 every REPLAY_KEYFRAME_INTERVAL frames are
+ * followed by a keyframe with the state that checksum covers, so a bisect can
+ * show which fields went differently too.
+ */
+
+struct ReplayHeader
+{
+    char magic[4];
+    uint32_t version;
+    // ParamReader::hash() of the params the replay was recorded with
+    uint64_t paramsHash;
+    uint32_t numPlayers;
+    // Simulation timestep
+    float dt;
+};
+
+// Size of one player's Controller in a frame record
+static const size_t REPLAY_CONTROLLER_SIZE = 4 * sizeof(float) + 1;
+static const size_t REPLAY_CHECKSUM_SIZE = sizeof(uint64_t);
+// Frames between keyframes, about a second
+static const unsigned REPLAY_KEYFRAME_INTERVAL = 30;
+
+// Packs a Controller into REPLAY_CONTROLLER_SIZE bytes and back, netplay uses
+// the same format on the wire
+void encodeController(const Controller &c, unsigned char *out);
+void decodeController(const unsigned char *in, Controller &c);
+
+class ReplayWriter
+{
+public:
+    ReplayWriter();
+    ~ReplayWriter();
+
+    // Returns false if the file couldn't be opened
+    bool open(const std::string &filename, uint64_t paramsHash,
+            unsigned numPlayers, float dt);
+    void close();
+    bool isOpen() const;
+
+    // Appends a frame, controllers must have numPlayers entries and
+    // checksum is the match's checksum after simulating them
+    void addFrame(const Controller *controllers, uint64_t checksum);
+    // True when the frame just added should be followed by a keyframe.  If
+    // addKeyframe isn't called before the next frame, the keyframe is
+    // written as missing.
+    bool wantsKeyframe() const;
+    // Writes the fighters and lastHitBy of the state after the last frame
+    void addKeyframe(const MatchSnapshot &snapshot);
+
+private:
+    FILE *file_;
+    std::string filename_;
+    unsigned numPlayers_;
+    unsigned numFrames_;
+    bool keyframeDue_;
+    // One frame record or keyframe, encoded before it is written
+    std::vector<unsigned char> record_;
+    std::vector<unsigned char> keyframe_;
+
+    // Writes snapshot as a keyframe, or a missing one if it is NULL
+    void writeKeyframe(const MatchSnapshot *snapshot);
+
+    // Reports a failed write and stops recording
+    void writeFailed();
+
+    ReplayWriter(const ReplayWriter &);
+};
+
+class ReplayReader
+{
+public:
+    ReplayReader();
+    ~ReplayReader();
+
+    // Maps the replay file, returns false if it is missing or malformed
+    bool open(const std::string &filename);
+    void close();
+    bool isOpen() const;
+
+    const ReplayHeader& getHeader() const;
+    unsigned getNumFrames() const;
+
+    // Reads the given frame into controllers, which must have numPlayers
+    // entries.  Returns false if frame is past the end.
+    bool readFrame(unsigned frame, Controller *controllers) const;
+    // Version 1 replays have no checksums
+    bool hasChecksums() const;
+    // Returns false if frame is past the end or there are no checksums
+    bool readChecksum(unsigned frame, uint64_t *checksum) const;
+    // Whether the state after frame was recorded, from version 3
+    bool hasKeyframe(unsigned frame) const;
+    // Fills in numPlayers, fighters and lastHitBy of snapshot from the state
+    // recorded after frame, leaving the rest.  Returns false if there isn't
+    // one.
+    bool readKeyframe(unsigned frame, MatchSnapshot &snapshot) const;
+
+    // Sequential playback, nextFrame reads the current frame and advances
+    void seek(unsigned frame);
+    unsigned tell() const;
+    bool nextFrame(Controller *controllers);
+
+private:
+    const unsigned char *data_;
+    size_t size_;
+    ReplayHeader header_;
+    size_t frameSize_;
+    // Zero when there are no keyframes
+    size_t keyframeSize_;
+    unsigned numFrames_;
+    unsigned frame_;
+
+    // Where a frame record starts, past any keyframes before it
+    const unsigned char *frameRecord(unsigned frame) const;
+
+    ReplayReader(const ReplayReader &);
+};
@@ -0,0 +1,286 @@
+#include "rollback.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include "audio.h"
+#include "timer.h"
+#include "trace.h"
+
+// Packets are a header then count encoded inputs, for frames starting at
+// first.  ack is how many of the receiver's frames the sender has, and
+// checksum is the sender's checksum after frame checksumFrame - 1.
+struct PacketHeader
+{
+    uint32_t first;
+    uint32_t ack;
+    uint16_t count;
+    uint32_t checksumFrame;
+    uint64_t checksum;
+};
+static const size_t HEADER_SIZE = 22;
+
+RollbackSession::RollbackSession(const ParamReader &params, unsigned localPlayer,
+        Transport *transport, unsigned frameDelay, float dt) :
+    match_(params, 2),
+    localPlayer_(localPlayer),
+    transport_(transport),
+    dt_(dt),
+    frame_(0),
+    localFrames_(std::min(frameDelay, MAX_FRAME_DELAY)),
+    remoteConfirmed_(0),
+    remoteAck_(0),
+    rollbackFrom_(NO_FRAME),
+    endFrame_(NO_FRAME),
+    remoteChecksumFrame_(0),
+    remoteChecksum_(0),
+    desyncFrame_(NO_FRAME),
+    snapshots_(MAX_PREDICTION)
+{
+    // The delayed frames at the start have no input
+    Controller none;
+    memset(&none, 0, sizeof(none));
+    for (unsigned f = 0; f < localFrames_; f++)
+        encodeController(none, localInputs_[f]);
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void RollbackSession::poll()
+{
+    unsigned char packet[HEADER_SIZE + MAX_UNACKED * REPLAY_CONTROLLER_SIZE];
+    size_t size;
+    while ((size = transport_->receive(packet, sizeof(packet))) > 0)
+        receive(packet, size);
+    rollback();
+    checkRemoteChecksum();
+}
+
+bool RollbackSession::advance(const Controller &local)
+{
+    bool ran = false;
+    if (endFrame_ == NO_FRAME)
+    {
+        if (frame_ >= remoteConfirmed_ + MAX_PREDICTION
+                || localFrames_ - remoteAck_ >= MAX_UNACKED)
+            stats_.stalls++;
+        else
+        {
+            // Kept encoded, so the local side uses exactly what the remote
+            // receives
+            encodeController(local, localInputs_[localFrames_ % INPUT_BUFFER]);
+            localFrames_++;
+            simulate();
+            ran = true;
+        }
+    }
+    // Sent even when nothing new was added, to resend anything lost
+    sendInputs();
+    return ran;
+}
+
+bool RollbackSession::isFinished() const
+{
+    return endFrame_ != NO_FRAME && remoteConfirmed_ >= endFrame_;
+}
+
+bool RollbackSession::isDesynced() const
+{
+    return desyncFrame_ != NO_FRAME;
+}
+
+unsigned RollbackSession::getDesyncFrame() const
+{
+    return desyncFrame_;
+}
+
+Match* RollbackSession::getMatch()
+{
+    return &match_;
+}
+
+unsigned RollbackSession::getLocalPlayer() const
+{
+    return localPlayer_;
+}
+
+unsigned RollbackSession::getFrame() const
+{
+    return frame_;
+}
+
+unsigned RollbackSession::getConfirmedFrame() const
+{
+    return std::min(frame_, remoteConfirmed_);
+}
+
+const RollbackStats& RollbackSession::getStats() const
+{
+    return stats_;
+}
+
+bool RollbackSession::readConfirmedFrame(unsigned frame, Controller *controllers,
+        uint64_t *checksum) const
+{
+    // Each buffer has moved on a different amount
+    if (frame >= getConfirmedFrame() || frame + INPUT_BUFFER <= frame_
+            || frame + INPUT_BUFFER <= localFrames_
+            || frame + INPUT_BUFFER <= remoteConfirmed_)
+        return false;
+    unsigned slot = frame % INPUT_BUFFER;
+    decodeController(localInputs_[slot], controllers[localPlayer_]);
+    decodeController(remoteInputs_[slot], controllers[1 - localPlayer_]);
+    *checksum = checksums_[slot];
+    return true;
+}
+
+bool RollbackSession::readConfirmedState(unsigned frame, MatchSnapshot &snapshot) const
+{
+    // The snapshot saved before simulating the next frame, or the match if
+    // that hasn't happened yet
+    if (frame >= getConfirmedFrame() || frame + MAX_PREDICTION < frame_)
+        return false;
+    if (frame + 1 == frame_)
+        match_.saveSnapshot(snapshot);
+    else
+        snapshot = snapshots_[(frame + 1) % MAX_PREDICTION];
+    return true;
+}
+
+void RollbackSession::receive(const unsigned char *packet, size_t size)
+{
+    if (size < HEADER_SIZE)
+        return;
+    PacketHeader header;
+    memcpy(&header.first, packet, 4);
+    memcpy(&header.ack, packet + 4, 4);
+    memcpy(&header.count, packet + 8, 2);
+    memcpy(&header.checksumFrame, packet + 10, 4);
+    memcpy(&header.checksum, packet + 14, 8);
+    if (size != HEADER_SIZE + header.count * REPLAY_CONTROLLER_SIZE)
+        return;
+
+    if (header.checksumFrame > remoteChecksumFrame_)
+    {
+        remoteChecksumFrame_ = header.checksumFrame;
+        remoteChecksum_ = header.checksum;
+    }
+
+    // Packets can arrive out of order, so acks only ever move forward
+    if (header.ack > remoteAck_ && header.ack <= localFrames_)
+        remoteAck_ = header.ack;
+
+    const unsigned char *inputs = packet + HEADER_SIZE;
+    for (unsigned i = 0; i < header.count; i++)
+    {
+        unsigned f = header.first + i;
+        if (f < remoteConfirmed_)
+            continue;
+        // Only contiguous input can be confirmed, and it must not overwrite
+        // frames that might still be re-simulated
+        if (f > remoteConfirmed_ || f + MAX_PREDICTION >= frame_ + INPUT_BUFFER)
+            break;
+
+        const unsigned char *input = inputs + i * REPLAY_CONTROLLER_SIZE;
+        unsigned slot = f % INPUT_BUFFER;
+        memcpy(remoteInputs_[slot], input, REPLAY_CONTROLLER_SIZE);
+        if (f < frame_ && memcmp(remoteUsed_[slot], input, REPLAY_CONTROLLER_SIZE))
+            rollbackFrom_ = std::min(rollbackFrom_, f);
+        remoteConfirmed_++;
+    }
+}
+
+void RollbackSession::sendInputs()
+{
+    unsigned char packet[HEADER_SIZE + MAX_UNACKED * REPLAY_CONTROLLER_SIZE];
+    PacketHeader header;
+    header.first = remoteAck_;
+    header.ack = remoteConfirmed_;
+    header.count = localFrames_ - remoteAck_;
+    // Frames before getConfirmedFrame() won't be simulated again
+    header.checksumFrame = getConfirmedFrame();
+    header.checksum = header.checksumFrame > 0 ?
+        checksums_[(header.checksumFrame - 1) % INPUT_BUFFER] : 0;
+    memcpy(packet, &header.first, 4);
+    memcpy(packet + 4, &header.ack, 4);
+    memcpy(packet + 8, &header.count, 2);
+    memcpy(packet + 10, &header.checksumFrame, 4);
+    memcpy(packet + 14, &header.checksum, 8);
+    for (unsigned i = 0; i < header.count; i++)
+        memcpy(packet + HEADER_SIZE + i * REPLAY_CONTROLLER_SIZE,
+                localInputs_[(header.first + i) % INPUT_BUFFER], REPLAY_CONTROLLER_SIZE);
+    transport_->send(packet, HEADER_SIZE + header.count * REPLAY_CONTROLLER_SIZE);
+}
+
+void RollbackSession::checkRemoteChecksum()
+{
+    // Only frames that are confirmed here too, and are still remembered
+    unsigned frame = remoteChecksumFrame_;
+    if (desyncFrame_ != NO_FRAME || frame == 0 || frame > getConfirmedFrame()
+            || frame + INPUT_BUFFER <= frame_)
+        return;
+    if (checksums_[(frame - 1) % INPUT_BUFFER] != remoteChecksum_)
+    {
+        desyncFrame_ = frame - 1;
+        std::cerr << "Netplay desynced at frame " << desyncFrame_ << '\n';
+    }
+}
+
+void RollbackSession::predictRemote(EncodedInput out) const
+{
+    // Assume the stick and buttons stay where they last were.  Press flags
+    // and stick velocities only last one frame, so they're never repeated.
+    Controller c;
+    memset(&c, 0, sizeof(c));
+    if (remoteConfirmed_ > 0)
+    {
+        decodeController(remoteInputs_[(remoteConfirmed_ - 1) % INPUT_BUFFER], c);
+        c.pressa = c.pressb = c.pressc = c.pressjump = false;
+        c.joyxv = c.joyyv = 0;
+    }
+    encodeController(c, out);
+}
+
+void RollbackSession::simulate()
+{
+    match_.saveSnapshot(snapshots_[frame_ % MAX_PREDICTION]);
+
+    unsigned slot = frame_ % INPUT_BUFFER;
+    if (frame_ < remoteConfirmed_)
+        memcpy(remoteUsed_[slot], remoteInputs_[slot], REPLAY_CONTROLLER_SIZE);
+    else
+        predictRemote(remoteUsed_[slot]);
+
+    Controller controllers[2];
+    decodeController(localInputs_[slot], controllers[localPlayer_]);
+    decodeController(remoteUsed_[slot], controllers[1 - localPlayer_]);
+    if (!match_.update(controllers, dt_))
+        endFrame_ = frame_ + 1;
+    checksums_[slot] = match_.checksum();
+    frame_++;
+}
+
+void RollbackSession::rollback()
+{
+    unsigned from = rollbackFrom_;
+    rollbackFrom_ = NO_FRAME;
+    if (from >= frame_)
+        return;
+
+    TraceScope span(TRACE_ROLLBACK_SPAN);
+    double start = get_time();
+    unsigned end = frame_;
+    match_.restoreSnapshot(snapshots_[from % MAX_PREDICTION]);
+    frame_ = from;
+    endFrame_ = NO_FRAME;
+    // Sounds were already played the first time through
+    set_sounds_muted(true);
+    while (frame_ < end && endFrame_ == NO_FRAME)
+        simulate();
+    set_sounds_muted(false);
+
+    double elapsed = get_time() - start;
+    stats_.rollbacks++;
+    stats_.resimulatedTicks += frame_ - from;
+    stats_.maxDepth = std::max(stats_.maxDepth, frame_ - from);
+    stats_.maxRollbackTime = std::max(stats_.maxRollbackTime, elapsed);
+    stats_.totalRollbackTime += elapsed;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "match.h"
+#include "replay.h"
+#include "transport.h"
+
+/*
+ * Two player online play with rollback.  Each peer runs the whole match.
+ * Local input is delayed by a few frames and sent to the other peer, and
+ * remote input that hasn't arrived yet is predicted.  When real input turns
+ * out to differ from the prediction the match is restored from a snapshot
+ * taken before that frame and re-simulated up to the present.
+ *
+ * Every packet carries all of the local input the remote hasn't
+ * acknowledged yet, so lost and reordered packets need no resending.  It
+ * also carries the Match::checksum() of the latest frame whose input is all
+ * confirmed, so a desync is noticed within a few frames of happening.  Both
+ * peers must use the same params.
+ */
+
+// Frames of remote input that can be predicted before the local side waits
+static const unsigned MAX_PREDICTION = 8;
+static const unsigned MAX_FRAME_DELAY = 16;
+
+struct RollbackStats
+{
+    unsigned rollbacks;
+    unsigned long resimulatedTicks;
+    // Most ticks re-simulated by one rollback
+    unsigned maxDepth;
+    // Advances skipped waiting for the remote
+    unsigned stalls;
+    // Longest a rollback took, in seconds
+    double maxRollbackTime;
+    double totalRollbackTime;
+};
+
+class RollbackSession
+{
+public:
+    // localPlayer is 0 or 1, and the remote plays the other.  The transport
+    // must outlive the session.
+    RollbackSession(const ParamReader &params, unsigned localPlayer,
+            Transport *transport, unsigned frameDelay, float dt);
+
+    // Reads everything the remote has sent and rolls back if any of it
+    // contradicts a prediction
+    void poll();
+    // Simulates the next frame with this frame's local input and sends it.
+    // Returns false, without using local, if the match has ended or the
+    // remote is too far behind to predict.
+    bool advance(const Controller &local);
+    // True once the match has ended on a frame where all input is confirmed
+    bool isFinished() const;
+    // True once the peers have disagreed about a confirmed frame.
+    // getDesyncFrame() is the first frame found to differ, which can be a
+    // little after where they actually went differently.
+    bool isDesynced() const;
+    unsigned getDesyncFrame() const;
+
+    Match* getMatch();
+    unsigned getLocalPlayer() const;
+    // Frames simulated, and how many of them have confirmed remote input
+    unsigned getFrame() const;
+    unsigned getConfirmedFrame() const;
+    const RollbackStats& getStats() const;
+    // Reads both players' input for a frame before getConfirmedFrame(), and
+    // the checksum after it, so netplay can be recorded as a replay.  Only
+    // recent frames are kept, returns false if frame is too old or not
+    // confirmed yet.
+    bool readConfirmedFrame(unsigned frame, Controller *controllers,
+            uint64_t *checksum) const;
+    // Copies the state after a confirmed frame, for a replay keyframe.  Only
+    // the last MAX_PREDICTION frames are kept.
+    bool readConfirmedState(unsigned frame, MatchSnapshot &snapshot) const;
+
+private:
+    // Frames of input kept, a power of two comfortably more than can be in
+    // flight
+    static const unsigned INPUT_BUFFER = 128;
+    // Local inputs sent and not yet acknowledged before the local side waits,
+    // which also bounds the packet size
+    static const unsigned MAX_UNACKED = 64;
+    static const unsigned NO_FRAME = ~0u;
+
+    typedef unsigned char EncodedInput[REPLAY_CONTROLLER_SIZE];
+
+    Match match_;
+    unsigned localPlayer_;
+    Transport *transport_;
+    float dt_;
+
+    // The next frame to simulate
+    unsigned frame_;
+    // Local input is known for frames before localFrames_, and remote input
+    // for frames before remoteConfirmed_
+    unsigned localFrames_;
+    unsigned remoteConfirmed_;
+    // Local frames the remote has confirmed
+    unsigned remoteAck_;
+    // Earliest frame simulated with a wrong prediction, or NO_FRAME
+    unsigned rollbackFrom_;
+    // Frame after the one the match ended on, or NO_FRAME
+    unsigned endFrame_;
+    // Latest checksum from the remote, for the frame before
+    // remoteChecksumFrame_, which is 0 if there isn't one
+    unsigned remoteChecksumFrame_;
+    uint64_t remoteChecksum_;
+    unsigned desyncFrame_;
+
+    // Indexed by frame % INPUT_BUFFER.  remoteUsed_ is what each simulated
+    // frame used for the remote, predicted or not.
+    EncodedInput localInputs_[INPUT_BUFFER];
+    EncodedInput remoteInputs_[INPUT_BUFFER];
+    EncodedInput remoteUsed_[INPUT_BUFFER];
+    // Match checksum after each frame
+    uint64_t checksums_[INPUT_BUFFER];
+    // State before each of the last MAX_PREDICTION frames, by frame %
+    // MAX_PREDICTION
+    std::vector<MatchSnapshot> snapshots_;
+
+    RollbackStats stats_;
+
+    void receive(const unsigned char *packet, size_t size);
+    void sendInputs();
+    void checkRemoteChecksum();
+    void predictRemote(EncodedInput out) const;
+    // Runs frame_ and moves on to the next
+    void simulate();
+    void rollback();
+
+    RollbackSession(const RollbackSession &);
+};
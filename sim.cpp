@@ -0,0 +1,835 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include "match.h"
+#include "replay.h"
+#include "rollback.h"
+#include "transport.h"
+#include "threadpool.h"
+#include "ParamReader.h"
+#include "timer.h"
+#include "trace.h"
+#include "archive.h"
+
+/*
+ * Headless simulator.  Plays matches between random controllers, or
+ * re-simulates recorded replays, as fast as possible with no windowing, audio
+ * or GPU.  Matches are spread across a pool of worker threads.  Can also play
+ * a netplay match between two peers over a simulated network, and find where
+ * two replays first go differently.
+ */
+
+static const float dt = 33.0f / 1000.0f;
+// Matches that run longer than this are called a draw
+static const float MAX_MATCH_TIME = 600.0f;
+
+void randomController(Controller &controller, unsigned &seed);
+
+// Plays one match between random controllers
+class RandomMatchTask : public Task
+{
+public:
+    RandomMatchTask(const ParamReader *params, unsigned nplayers,
+            unsigned seed, const std::string &recordFile) :
+        ok(false), params_(params), nplayers_(nplayers), seed_(seed),
+        recordFile_(recordFile)
+    {}
+
+    virtual void run()
+    {
+        Match match(*params_, nplayers_);
+        Controller controllers[MAX_PLAYERS];
+        memset(controllers, 0, sizeof(controllers));
+
+        ReplayWriter recorder;
+        if (!recordFile_.empty() &&
+                !recorder.open(recordFile_, params_->hash(), nplayers_, dt))
+            return;
+
+        MatchSnapshot keyframe;
+        bool running = true;
+        while (running && match.getResult().ticks * dt < MAX_MATCH_TIME)
+        {
+            for (unsigned i = 0; i < nplayers_; i++)
+                randomController(controllers[i], seed_);
+            running = match.update(controllers, dt);
+            if (recorder.isOpen())
+                recorder.addFrame(controllers, match.checksum());
+            if (recorder.wantsKeyframe())
+            {
+                match.saveSnapshot(keyframe);
+                recorder.addKeyframe(keyframe);
+            }
+        }
+        // The recorder closes itself if a write fails
+        if (!recordFile_.empty() && !recorder.isOpen())
+            return;
+        result = match.getResult();
+        ok = true;
+    }
+
+    MatchResult result;
+    bool ok;
+
+private:
+    const ParamReader *params_;
+    unsigned nplayers_;
+    unsigned seed_;
+    std::string recordFile_;
+};
+
+// Re-simulates a recorded replay
+class ReplayTask : public Task
+{
+public:
+    ReplayTask(const ParamReader *params, const std::string &filename) :
+        frames(0), desyncFrame(-1), ok(false), params_(params), filename_(filename)
+    {}
+
+    virtual void run()
+    {
+        ReplayReader replay;
+        if (!replay.open(filename_))
+            return;
+        const ReplayHeader &header = replay.getHeader();
+        if (header.numPlayers > MAX_PLAYERS)
+        {
+            std::cerr << filename_ << " has too many players\n";
+            return;
+        }
+        if (header.paramsHash != params_->hash())
+            std::cerr << "WARNING: " << filename_ << " was recorded with different params\n";
+        if (header.dt != dt)
+            std::cerr << "WARNING: " << filename_ << " was recorded with a different timestep\n";
+
+        Match match(*params_, header.numPlayers);
+        Controller controllers[MAX_PLAYERS];
+        bool running = true;
+        while (running && replay.nextFrame(controllers))
+        {
+            running = match.update(controllers, dt);
+            uint64_t checksum;
+            if (desyncFrame < 0 && replay.readChecksum(replay.tell() - 1, &checksum)
+                    && checksum != match.checksum())
+                desyncFrame = replay.tell() - 1;
+        }
+
+        frames = replay.getNumFrames();
+        result = match.getResult();
+        ok = true;
+    }
+
+    MatchResult result;
+    unsigned frames;
+    // First frame that didn't match the checksum recorded, or -1
+    int desyncFrame;
+    bool ok;
+
+private:
+    const ParamReader *params_;
+    std::string filename_;
+};
+
+// Totals over many matches
+struct BatchStats
+{
+    unsigned matches;
+    unsigned long ticks;
+    unsigned minTicks, maxTicks;
+    unsigned draws;
+    unsigned numPlayers;
+    unsigned wins[MAX_PLAYERS];
+    unsigned kos[MAX_PLAYERS];
+    unsigned deaths[MAX_PLAYERS];
+    double damageDealt[MAX_PLAYERS];
+    double damageTaken[MAX_PLAYERS];
+};
+
+// Repeats of the benchmark workload, the best run is reported
+static const unsigned BENCH_RUNS = 5;
+// Ticks played before snapshots are timed, so there's something in them.
+// Play then carries on until there are live particles, for at most the
+// limit.
+static const unsigned SNAPSHOT_WARMUP_TICKS = 300;
+static const unsigned SNAPSHOT_MAX_WARMUP_TICKS = 30000;
+// Ticks re-simulated from a restored snapshot to check it was exact
+static const unsigned SNAPSHOT_CHECK_TICKS = 100;
+static const unsigned SNAPSHOT_BENCH_REPEATS = 100000;
+// A rollback has to re-simulate at least this many ticks within one 60Hz
+// frame to keep up
+static const unsigned ROLLBACK_TARGET_TICKS = 8;
+static const float FRAME_BUDGET = 0.016f;
+
+void usage(const char *prog);
+int runBenchmark(const ParamReader &params, unsigned nplayers, unsigned nmatches);
+int benchmarkSnapshots(const ParamReader &params, unsigned nplayers);
+int runRandomMatches(const ParamReader &params, ThreadPool &pool, unsigned nplayers,
+        unsigned nmatches, unsigned seed, const std::string &recordFile);
+int runReplays(const ParamReader &params, ThreadPool &pool,
+        const std::vector<std::string> &files);
+int runNetplayTest(const ParamReader &params, float latency, float jitter,
+        unsigned delay, float loss, const std::string &recordFile);
+int runBisect(const ParamReader &params, const std::vector<std::string> &files);
+void addResult(BatchStats &stats, const MatchResult &result);
+void printStats(const BatchStats &stats, double elapsed, unsigned nthreads);
+
+int main(int argc, char **argv)
+{
+    std::string recordFile, traceFile;
+    std::vector<std::string> replayFiles, bisectFiles;
+    std::vector<std::string> args;
+    unsigned nthreads = 0;
+    bool bench = false, netplay = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            recordFile = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            traceFile = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            nthreads = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--bench"))
+            bench = true;
+        else if (!strcmp(argv[i], "--netplay-test"))
+            netplay = true;
+        else if (!strcmp(argv[i], "--replay"))
+        {
+            while (i + 1 < argc)
+                replayFiles.push_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bisect"))
+        {
+            while (i + 1 < argc)
+                bisectFiles.push_back(argv[++i]);
+            if (bisectFiles.empty() || bisectFiles.size() > 2)
+                usage(argv[0]);
+        }
+        else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else
+            args.push_back(argv[i]);
+    }
+    if ((args.size() > 3 && !netplay) || (!replayFiles.empty() && !args.empty())
+            || (bench && (!replayFiles.empty() || args.size() > 2
+                    || !traceFile.empty()))
+            || (netplay && (bench || !replayFiles.empty() || args.size() > 4))
+            || (!bisectFiles.empty() && (bench || netplay || !replayFiles.empty()
+                    || !recordFile.empty() || !args.empty())))
+        usage(argv[0]);
+
+    open_asset_archive("ssb.pak");
+    ParamReader params("params.dat");
+    if (!params.isValid())
+        return 1;
+
+    if (bench)
+    {
+        unsigned nplayers = args.size() > 0 ? std::min<int>(MAX_PLAYERS, std::max(1, atoi(args[0].c_str()))) : 2;
+        unsigned nmatches = args.size() > 1 ? std::max(1, atoi(args[1].c_str())) : 50;
+        return runBenchmark(params, nplayers, nmatches);
+    }
+
+    if (!bisectFiles.empty())
+        return runBisect(params, bisectFiles);
+
+    if (!traceFile.empty() && !trace_open(traceFile.c_str()))
+        return 1;
+    if (netplay)
+    {
+        float latency = args.size() > 0 ? atof(args[0].c_str()) / 1000.0f : 0.1f;
+        float jitter = args.size() > 1 ? atof(args[1].c_str()) / 1000.0f : 0.03f;
+        unsigned delay = args.size() > 2 ? std::max(0, atoi(args[2].c_str())) : 2;
+        float loss = args.size() > 3 ? atof(args[3].c_str()) / 100.0f : 0.05f;
+        int status = runNetplayTest(params, latency, jitter, delay, loss, recordFile);
+        trace_close();
+        return status;
+    }
+
+    // Each pool thread traces to its own ring, so tids are pool threads
+    ThreadPool pool(nthreads);
+
+    int status;
+    if (!replayFiles.empty())
+        status = runReplays(params, pool, replayFiles);
+    else
+    {
+        unsigned nplayers = args.size() > 0 ? std::min<int>(MAX_PLAYERS, std::max(1, atoi(args[0].c_str()))) : 2;
+        unsigned nmatches = args.size() > 1 ? std::max(1, atoi(args[1].c_str())) : 1;
+        unsigned seed = args.size() > 2 ? atoi(args[2].c_str()) : 0;
+        status = runRandomMatches(params, pool, nplayers, nmatches, seed, recordFile);
+    }
+    trace_close();
+    return status;
+}
+
+void usage(const char *prog)
+{
+    std::cout << "usage: " << prog << " [--threads N] [--trace FILE] [--record FILE] [nplayers] [nmatches] [seed]\n"
+        << "       " << prog << " [--threads N] [--trace FILE] --replay FILE...\n"
+        << "       " << prog << " --bench [nplayers] [nmatches]\n"
+        << "       " << prog << " [--trace FILE] [--record FILE] --netplay-test [latency_ms] [jitter_ms] [delay] [loss_percent]\n"
+        << "       " << prog << " --bisect REPLAY [REPLAY]\n";
+    exit(1);
+}
+
+int runRandomMatches(const ParamReader &params, ThreadPool &pool, unsigned nplayers,
+        unsigned nmatches, unsigned seed, const std::string &recordFile)
+{
+    double start = get_time();
+
+    // Each match gets its own seed, so results don't depend on which thread
+    // ran what.  With several matches each gets its own numbered replay.
+    std::vector<RandomMatchTask*> tasks;
+    for (unsigned m = 0; m < nmatches; m++)
+    {
+        std::stringstream filename;
+        if (!recordFile.empty())
+        {
+            filename << recordFile;
+            if (nmatches > 1)
+                filename << '.' << m;
+        }
+        tasks.push_back(new RandomMatchTask(&params, nplayers, seed + m, filename.str()));
+        pool.submit(tasks.back());
+    }
+    pool.wait();
+
+    BatchStats stats;
+    memset(&stats, 0, sizeof(stats));
+    int ret = 0;
+    for (unsigned m = 0; m < nmatches; m++)
+    {
+        if (tasks[m]->ok)
+            addResult(stats, tasks[m]->result);
+        else
+            ret = 1;
+        delete tasks[m];
+    }
+
+    printStats(stats, get_time() - start, pool.getNumThreads());
+    return ret;
+}
+
+int runReplays(const ParamReader &params, ThreadPool &pool,
+        const std::vector<std::string> &files)
+{
+    double start = get_time();
+
+    std::vector<ReplayTask*> tasks;
+    for (unsigned m = 0; m < files.size(); m++)
+    {
+        tasks.push_back(new ReplayTask(&params, files[m]));
+        pool.submit(tasks.back());
+    }
+    pool.wait();
+
+    BatchStats stats;
+    memset(&stats, 0, sizeof(stats));
+    int ret = 0;
+    for (unsigned m = 0; m < files.size(); m++)
+    {
+        const ReplayTask *task = tasks[m];
+        if (!task->ok)
+        {
+            ret = 1;
+            delete tasks[m];
+            continue;
+        }
+        addResult(stats, task->result);
+
+        // Print the outcome so runs can be compared
+        std::cout << files[m] << ": " << task->result.ticks << '/' << task->frames << " frames";
+        for (unsigned i = 0; i < task->result.numPlayers; i++)
+            std::cout << "  P" << i + 1 << " lives " << task->result.lives[i]
+                << " damage taken " << task->result.damageTaken[i];
+        if (task->desyncFrame >= 0)
+        {
+            std::cout << "  DESYNC at frame " << task->desyncFrame;
+            ret = 1;
+        }
+        std::cout << '\n';
+        delete tasks[m];
+    }
+
+    printStats(stats, get_time() - start, pool.getNumThreads());
+    return ret;
+}
+
+int runBenchmark(const ParamReader &params, unsigned nplayers, unsigned nmatches)
+{
+    // Single threaded on the calling thread with fixed seeds, so the same
+    // ticks are simulated on every run and runs are comparable across builds
+    double best = 0;
+    unsigned long ticks = 0;
+    for (unsigned run = 0; run < BENCH_RUNS; run++)
+    {
+        ticks = 0;
+        double start = get_time();
+        for (unsigned m = 0; m < nmatches; m++)
+        {
+            RandomMatchTask task(&params, nplayers, m, "");
+            task.run();
+            if (!task.ok)
+                return 1;
+            ticks += task.result.ticks;
+        }
+        double elapsed = get_time() - start;
+        if (elapsed > 0)
+            best = std::max(best, ticks / elapsed);
+    }
+
+    std::cout << "Benchmark: " << nplayers << " players, " << nmatches
+        << " matches, " << ticks << " ticks per run\n"
+        << "Best of " << BENCH_RUNS << ": " << best << " ticks/s\n";
+    return benchmarkSnapshots(params, nplayers);
+}
+
+int benchmarkSnapshots(const ParamReader &params, unsigned nplayers)
+{
+    Match match(params, nplayers);
+    Controller controllers[MAX_PLAYERS];
+    memset(controllers, 0, sizeof(controllers));
+    unsigned seed = 0;
+    for (unsigned t = 0; t < SNAPSHOT_WARMUP_TICKS
+            || match.getExplosions()->getNumParticles() == 0; t++)
+    {
+        if (t == SNAPSHOT_MAX_WARMUP_TICKS)
+        {
+            std::cerr << "No particles to snapshot after " << t << " ticks\n";
+            return 1;
+        }
+        for (unsigned i = 0; i < nplayers; i++)
+            randomController(controllers[i], seed);
+        match.update(controllers, dt);
+    }
+
+    // Restoring and replaying the same input must land on the same state.
+    // Random controllers carry state between ticks, so they're reset too.
+    MatchSnapshot start, end;
+    match.saveSnapshot(start);
+    // A straight round trip, particles included, must change nothing
+    match.restoreSnapshot(start);
+    match.saveSnapshot(end);
+    if (end.hash() != start.hash() || end.particles.count != start.particles.count)
+    {
+        std::cerr << "Snapshot round trip is not exact\n";
+        return 1;
+    }
+    Controller startControllers[MAX_PLAYERS];
+    memcpy(startControllers, controllers, sizeof(controllers));
+    unsigned checkSeed = seed;
+    uint64_t hashes[2];
+    for (unsigned pass = 0; pass < 2; pass++)
+    {
+        match.restoreSnapshot(start);
+        memcpy(controllers, startControllers, sizeof(controllers));
+        seed = checkSeed;
+        for (unsigned t = 0; t < SNAPSHOT_CHECK_TICKS; t++)
+        {
+            for (unsigned i = 0; i < nplayers; i++)
+                randomController(controllers[i], seed);
+            match.update(controllers, dt);
+        }
+        match.saveSnapshot(end);
+        hashes[pass] = end.hash();
+    }
+    if (hashes[0] != hashes[1])
+    {
+        std::cerr << "Snapshot restore is not exact\n";
+        return 1;
+    }
+
+    // Timed on the state with live particles
+    match.restoreSnapshot(start);
+    double start_time = get_time();
+    for (unsigned r = 0; r < SNAPSHOT_BENCH_REPEATS; r++)
+        match.saveSnapshot(end);
+    double save = get_time() - start_time;
+    start_time = get_time();
+    for (unsigned r = 0; r < SNAPSHOT_BENCH_REPEATS; r++)
+        match.restoreSnapshot(end);
+    double restore = get_time() - start_time;
+    start_time = get_time();
+    uint64_t h = 0;
+    for (unsigned r = 0; r < SNAPSHOT_BENCH_REPEATS; r++)
+        h += end.hash();
+    double hash = get_time() - start_time;
+    if (h != end.hash() * SNAPSHOT_BENCH_REPEATS)
+    {
+        std::cerr << "Snapshot hash is not stable\n";
+        return 1;
+    }
+    start_time = get_time();
+    h = 0;
+    for (unsigned r = 0; r < SNAPSHOT_BENCH_REPEATS; r++)
+        h += match.checksum();
+    double checksum = get_time() - start_time;
+    if (h != match.checksum() * SNAPSHOT_BENCH_REPEATS)
+    {
+        std::cerr << "Match checksum is not stable\n";
+        return 1;
+    }
+
+    std::cout << "Snapshot: " << end.getSize() << " bytes, "
+        << end.particles.count << " particles, hash " << std::hex << end.hash()
+        << std::dec << '\n'
+        << "  save " << save / SNAPSHOT_BENCH_REPEATS * 1e6 << "us, restore "
+        << restore / SNAPSHOT_BENCH_REPEATS * 1e6 << "us, hash "
+        << hash / SNAPSHOT_BENCH_REPEATS * 1e6 << "us, per tick checksum "
+        << checksum / SNAPSHOT_BENCH_REPEATS * 1e6 << "us\n";
+    return 0;
+}
+
+int runNetplayTest(const ParamReader &params, float latency, float jitter,
+        unsigned delay, float loss, const std::string &recordFile)
+{
+    // Both peers run on this thread against a simulated clock, so the
+    // network conditions are the same however fast the machine is
+    LoopbackTransport transports[2] = {
+        LoopbackTransport(latency, jitter, loss, 1),
+        LoopbackTransport(latency, jitter, loss, 2)
+    };
+    LoopbackTransport::connect(transports[0], transports[1]);
+    RollbackSession *peers[2];
+    Controller next[2];
+    unsigned seeds[2] = { 1, 2 };
+    // Every input each peer used, to check against an offline match
+    std::vector<Controller> inputs[2];
+    // Each peer's view of the match can be recorded, to be compared with
+    // --bisect
+    ReplayWriter recorders[2];
+    unsigned recorded[2] = { 0, 0 };
+    MatchSnapshot keyframe;
+    for (unsigned p = 0; p < 2; p++)
+    {
+        peers[p] = new RollbackSession(params, p, &transports[p], delay, dt);
+        memset(&next[p], 0, sizeof(next[p]));
+        randomController(next[p], seeds[p]);
+        std::stringstream filename;
+        filename << recordFile << '.' << p;
+        if (!recordFile.empty() && !recorders[p].open(filename.str(), params.hash(), 2, dt))
+            return 1;
+    }
+
+    double start = get_time();
+    double now = 0.0;
+    unsigned steps = 0;
+    while (!(peers[0]->isFinished() && peers[1]->isFinished())
+            && now < 2 * MAX_MATCH_TIME)
+    {
+        for (unsigned p = 0; p < 2; p++)
+        {
+            transports[p].setTime(now);
+            peers[p]->poll();
+            if (peers[p]->advance(next[p]))
+            {
+                inputs[p].push_back(next[p]);
+                randomController(next[p], seeds[p]);
+            }
+            Controller confirmed[2];
+            uint64_t checksum;
+            while (peers[p]->readConfirmedFrame(recorded[p], confirmed, &checksum))
+            {
+                recorders[p].addFrame(confirmed, checksum);
+                if (recorders[p].wantsKeyframe()
+                        && peers[p]->readConfirmedState(recorded[p], keyframe))
+                    recorders[p].addKeyframe(keyframe);
+                recorded[p]++;
+            }
+        }
+        now += dt;
+        steps++;
+    }
+    double elapsed = get_time() - start;
+
+    // Both peers must agree with each other, and with the same inputs played
+    // without a network.  Local input is delayed, so it starts with idle frames.
+    MatchSnapshot snapshots[3];
+    Match offline(params, 2);
+    Controller controllers[2];
+    unsigned frames = peers[0]->getFrame();
+    for (unsigned f = 0; f < frames; f++)
+    {
+        for (unsigned p = 0; p < 2; p++)
+        {
+            memset(&controllers[p], 0, sizeof(controllers[p]));
+            if (f >= delay && f - delay < inputs[p].size())
+                controllers[p] = inputs[p][f - delay];
+        }
+        offline.update(controllers, dt);
+    }
+    peers[0]->getMatch()->saveSnapshot(snapshots[0]);
+    peers[1]->getMatch()->saveSnapshot(snapshots[1]);
+    offline.saveSnapshot(snapshots[2]);
+
+    std::cout << "Netplay: " << latency * 1000 << "ms latency, " << jitter * 1000
+        << "ms jitter, " << loss * 100 << "% loss, " << delay << " frames delay\n"
+        << "Played " << frames << " frames in " << steps << " steps, "
+        << elapsed << "s\n";
+    double resimTime = 0;
+    unsigned long resimTicks = 0;
+    for (unsigned p = 0; p < 2; p++)
+    {
+        const RollbackStats &stats = peers[p]->getStats();
+        std::cout << "P" << p + 1 << ": frame " << peers[p]->getFrame() << ", "
+            << stats.rollbacks << " rollbacks, " << stats.resimulatedTicks
+            << " ticks re-simulated, max depth " << stats.maxDepth << ", "
+            << stats.stalls << " stalls, longest rollback "
+            << stats.maxRollbackTime * 1e3 << "ms, hash " << std::hex
+            << snapshots[p].hash() << std::dec << '\n';
+        resimTime += stats.totalRollbackTime;
+        resimTicks += stats.resimulatedTicks;
+    }
+    if (resimTicks > 0)
+    {
+        unsigned perFrame = FRAME_BUDGET / (resimTime / resimTicks);
+        std::cout << "Re-simulation: " << resimTime / resimTicks * 1e6
+            << "us per tick, " << perFrame << " ticks per " << FRAME_BUDGET * 1e3
+            << "ms frame (need " << ROLLBACK_TARGET_TICKS << ")\n";
+    }
+
+    int ret = 0;
+    if (!peers[0]->isFinished() || !peers[1]->isFinished())
+    {
+        std::cerr << "Netplay match did not finish\n";
+        ret = 1;
+    }
+    else if (peers[0]->getFrame() != peers[1]->getFrame()
+            || snapshots[0].hash() != snapshots[1].hash())
+    {
+        std::cerr << "Peers desynced\n";
+        ret = 1;
+    }
+    else if (snapshots[0].hash() != snapshots[2].hash())
+    {
+        std::cerr << "Netplay result differs from the offline match\n";
+        ret = 1;
+    }
+    delete peers[0];
+    delete peers[1];
+    return ret;
+}
+
+// Exit status is 0 if the runs agree, 1 if they don't and 2 on errors, like
+// diff
+int runBisect(const ParamReader &params, const std::vector<std::string> &files)
+{
+    // Each replay's re-simulation is checked against the checksums it
+    // recorded, and compared field by field with the first keyframe it
+    // recorded once they differ.  With two, they are also re-simulated side
+    // by side and compared field by field where they first differ.
+    const unsigned nruns = files.size();
+    ReplayReader replays[2];
+    unsigned frames = ~0u;
+    for (unsigned r = 0; r < nruns; r++)
+    {
+        if (!replays[r].open(files[r]))
+            return 2;
+        const ReplayHeader &header = replays[r].getHeader();
+        if (header.numPlayers > MAX_PLAYERS
+                || header.numPlayers != replays[0].getHeader().numPlayers)
+        {
+            std::cerr << files[r] << " has the wrong number of players\n";
+            return 2;
+        }
+        if (header.paramsHash != params.hash())
+            std::cerr << "WARNING: " << files[r] << " was recorded with different params\n";
+        if (!replays[r].hasChecksums())
+            std::cerr << "WARNING: " << files[r] << " has no checksums\n";
+        else if (header.version < 3)
+            std::cerr << "WARNING: " << files[r] << " has no keyframes to compare fields with\n";
+        frames = std::min(frames, replays[r].getNumFrames());
+    }
+
+    const unsigned nplayers = replays[0].getHeader().numPlayers;
+    Match *matches[2] = { NULL, NULL };
+    for (unsigned r = 0; r < nruns; r++)
+        matches[r] = new Match(params, nplayers);
+    // First frames where the inputs, the checksums recorded and each
+    // re-simulation and its recording differ, or -1
+    int inputFrame = -1, recordedFrame = -1, replayedFrame[2] = { -1, -1 };
+    int divergedFrame = -1;
+    // The first keyframe at or after replayedFrame, and how it differs
+    int keyframeFrame[2] = { -1, -1 };
+    std::vector<std::string> keyframeDiffs[2], divergedDiffs;
+    MatchSnapshot snapshots[2], recordedState;
+    for (unsigned f = 0; f < frames; f++)
+    {
+        Controller controllers[2][MAX_PLAYERS];
+        uint64_t checksums[2], recorded[2];
+        bool haveRecorded[2];
+        // Carries on after a run goes wrong until its next keyframe
+        bool searching = nruns == 2 && divergedFrame < 0;
+        for (unsigned r = 0; r < nruns; r++)
+        {
+            replays[r].readFrame(f, controllers[r]);
+            matches[r]->update(controllers[r], dt);
+            checksums[r] = matches[r]->checksum();
+            haveRecorded[r] = replays[r].readChecksum(f, &recorded[r]);
+            if (replayedFrame[r] < 0 && haveRecorded[r] && recorded[r] != checksums[r])
+                replayedFrame[r] = f;
+            if (replayedFrame[r] >= 0 && keyframeFrame[r] < 0 && replays[r].hasKeyframe(f))
+            {
+                // Only the fields the keyframe has are read, the rest match
+                matches[r]->saveSnapshot(snapshots[r]);
+                recordedState = snapshots[r];
+                replays[r].readKeyframe(f, recordedState);
+                recordedState.diff(snapshots[r], keyframeDiffs[r]);
+                keyframeFrame[r] = f;
+            }
+            if (replayedFrame[r] < 0 || (keyframeFrame[r] < 0
+                        && replays[r].getHeader().version >= 3))
+                searching = true;
+        }
+
+        if (nruns == 2 && divergedFrame < 0)
+        {
+            if (inputFrame < 0 && memcmp(controllers[0], controllers[1],
+                        nplayers * sizeof(Controller)) != 0)
+                inputFrame = f;
+            if (recordedFrame < 0 && haveRecorded[0] && haveRecorded[1]
+                    && recorded[0] != recorded[1])
+                recordedFrame = f;
+            if (checksums[0] != checksums[1])
+            {
+                divergedFrame = f;
+                matches[0]->saveSnapshot(snapshots[0]);
+                matches[1]->saveSnapshot(snapshots[1]);
+                snapshots[0].diff(snapshots[1], divergedDiffs);
+            }
+        }
+        if (!searching)
+            break;
+    }
+
+    std::cout << "Compared " << frames << " frames\n";
+    for (unsigned r = 0; r < nruns; r++)
+    {
+        std::cout << files[r];
+        if (replayedFrame[r] < 0)
+        {
+            std::cout << " re-simulates as recorded\n";
+            continue;
+        }
+        std::cout << " re-simulates differently from its recording from frame "
+            << replayedFrame[r] << '\n';
+        if (keyframeFrame[r] < 0)
+        {
+            std::cout << "  No recorded state after it to compare with\n";
+            continue;
+        }
+        std::cout << "  Recorded vs re-simulated state after frame " << keyframeFrame[r] << ":\n";
+        for (unsigned i = 0; i < keyframeDiffs[r].size(); i++)
+            std::cout << "    " << keyframeDiffs[r][i] << '\n';
+    }
+    if (nruns == 2)
+    {
+        if (inputFrame >= 0)
+            std::cout << "Inputs first differ at frame " << inputFrame << '\n';
+        if (recordedFrame >= 0)
+            std::cout << "Recorded checksums first differ at frame " << recordedFrame << '\n';
+        if (divergedFrame >= 0)
+        {
+            std::cout << "Re-simulations first differ after frame " << divergedFrame << ":\n";
+            for (unsigned i = 0; i < divergedDiffs.size(); i++)
+                std::cout << "  " << divergedDiffs[i] << '\n';
+        }
+        else
+            std::cout << "Re-simulations match\n";
+    }
+
+    delete matches[0];
+    delete matches[1];
+    return divergedFrame >= 0 || replayedFrame[0] >= 0 || replayedFrame[1] >= 0
+        || recordedFrame >= 0;
+}
+
+void addResult(BatchStats &stats, const MatchResult &result)
+{
+    if (stats.matches == 0 || result.ticks < stats.minTicks)
+        stats.minTicks = result.ticks;
+    stats.maxTicks = std::max(stats.maxTicks, result.ticks);
+    stats.matches++;
+    stats.ticks += result.ticks;
+    stats.numPlayers = std::max(stats.numPlayers, result.numPlayers);
+
+    if (result.winner >= 0)
+        stats.wins[result.winner]++;
+    else
+        stats.draws++;
+    for (unsigned i = 0; i < result.numPlayers; i++)
+    {
+        stats.kos[i] += result.kos[i];
+        stats.deaths[i] += result.deaths[i];
+        stats.damageDealt[i] += result.damageDealt[i];
+        stats.damageTaken[i] += result.damageTaken[i];
+    }
+}
+
+void printStats(const BatchStats &stats, double elapsed, unsigned nthreads)
+{
+    std::cout << "Simulated " << stats.matches << " matches, " << stats.ticks
+        << " ticks in " << elapsed << "s on " << nthreads << " threads\n";
+    if (elapsed > 0)
+        std::cout << stats.matches / elapsed << " matches/s, "
+            << stats.ticks / elapsed << " ticks/s\n";
+    if (stats.matches == 0)
+        return;
+
+    std::cout << "Match length: mean " << stats.ticks * dt / stats.matches
+        << "s  min " << stats.minTicks * dt << "s  max " << stats.maxTicks * dt
+        << "s  draws " << stats.draws << '\n';
+    std::cout << "Player  Wins    KOs  Deaths  Dmg dealt/match  Dmg taken/match\n";
+    for (unsigned i = 0; i < stats.numPlayers; i++)
+    {
+        std::cout << "P" << std::left << std::setw(6) << i + 1 << std::right
+            << std::setw(5) << stats.wins[i]
+            << std::setw(7) << stats.kos[i]
+            << std::setw(8) << stats.deaths[i]
+            << std::setw(17) << stats.damageDealt[i] / stats.matches
+            << std::setw(17) << stats.damageTaken[i] / stats.matches << '\n';
+    }
+}
+
+void randomController(Controller &controller, unsigned &seed)
+{
+    // Press flags and stick velocities only last a single frame
+    controller.pressa = false;
+    controller.pressb = false;
+    controller.pressc = false;
+    controller.pressjump = false;
+    controller.joyxv = 0;
+    controller.joyyv = 0;
+
+    // Every so often, move the stick somewhere new
+    if (rand_r(&seed) % 10 == 0)
+    {
+        float newx = (rand_r(&seed) % 201 - 100) / 100.0f;
+        float newy = (rand_r(&seed) % 201 - 100) / 100.0f;
+        controller.joyxv = newx - controller.joyx;
+        controller.joyyv = newy - controller.joyy;
+        controller.joyx = newx;
+        controller.joyy = newy;
+    }
+
+    // Mash the buttons
+    if (rand_r(&seed) % 15 == 0)
+    {
+        controller.pressa = !controller.buttona;
+        controller.buttona = true;
+    }
+    else
+        controller.buttona = false;
+
+    if (rand_r(&seed) % 30 == 0)
+    {
+        controller.pressjump = !controller.jumpbutton;
+        controller.jumpbutton = true;
+    }
+    else
+        controller.jumpbutton = false;
+}
@@ -1,14 +1,18 @@
 #version 330
 
+layout(std140) uniform Frame
+{
+    mat4 projection;
+};
+
 layout(location = 0) in vec4 position;
 
-uniform mat4 transform;
-uniform sampler2D texture;
+uniform vec4 rect; // center, then size
 
 centroid out vec2 frag_texcoord;
 
 void main()
 {
-    gl_Position = transform * position;
+    gl_Position = projection * vec4(rect.xy + position.xy * rect.zw, 0.0f, 1.0f);
     frag_texcoord = position.xy + vec2(0.5f);
 }
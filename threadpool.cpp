@@ -0,0 +1,107 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned nthreads) :
+    nextWorker_(0), queued_(0), pending_(0), stopping_(false)
+{
+    if (nthreads == 0)
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < nthreads; i++)
+        workers_.push_back(new Worker());
+    for (unsigned i = 0; i < nthreads; i++)
+        threads_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    workAvailable_.notify_all();
+    for (unsigned i = 0; i < threads_.size(); i++)
+        threads_[i].join();
+    for (unsigned i = 0; i < workers_.size(); i++)
+        delete workers_[i];
+}
+
+unsigned ThreadPool::getNumThreads() const
+{
+    return threads_.size();
+}
+
+void ThreadPool::submit(Task *task)
+{
+    Worker *worker = workers_[nextWorker_];
+    nextWorker_ = (nextWorker_ + 1) % workers_.size();
+    {
+        std::unique_lock<std::mutex> guard(worker->lock);
+        worker->tasks.push_back(task);
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        queued_++;
+        pending_++;
+    }
+    workAvailable_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while (pending_ > 0)
+        allDone_.wait(guard);
+}
+
+Task* ThreadPool::takeTask(unsigned idx)
+{
+    // Own queue first, newest task
+    {
+        Worker *worker = workers_[idx];
+        std::unique_lock<std::mutex> guard(worker->lock);
+        if (!worker->tasks.empty())
+        {
+            Task *task = worker->tasks.back();
+            worker->tasks.pop_back();
+            return task;
+        }
+    }
+    // Then steal the oldest task from someone else
+    for (unsigned i = 1; i < workers_.size(); i++)
+    {
+        Worker *victim = workers_[(idx + i) % workers_.size()];
+        std::unique_lock<std::mutex> guard(victim->lock);
+        if (!victim->tasks.empty())
+        {
+            Task *task = victim->tasks.front();
+            victim->tasks.pop_front();
+            return task;
+        }
+    }
+    return NULL;
+}
+
+void ThreadPool::workerLoop(unsigned idx)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            while (queued_ == 0 && !stopping_)
+                workAvailable_.wait(guard);
+            if (queued_ == 0 && stopping_)
+                return;
+            // Claim a task, one is guaranteed to be in some queue
+            queued_--;
+        }
+
+        Task *task = NULL;
+        while (!task)
+            task = takeTask(idx);
+        task->run();
+
+        std::unique_lock<std::mutex> guard(lock_);
+        if (--pending_ == 0)
+            allDone_.notify_all();
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A unit of work for a ThreadPool
+class Task
+{
+public:
+    virtual ~Task() {}
+    virtual void run() = 0;
+};
+
+/*
+ * Fixed set of worker threads, each with its own queue of tasks.  Workers
+ * take the newest task from their own queue, and when that is empty steal
+ * the oldest task from another worker.
+ */
+class ThreadPool
+{
+public:
+    // nthreads of 0 uses one thread per core
+    explicit ThreadPool(unsigned nthreads = 0);
+    ~ThreadPool();
+
+    unsigned getNumThreads() const;
+
+    // Queues a task, the caller keeps ownership and must keep it alive until
+    // wait() returns
+    void submit(Task *task);
+    // Blocks until every submitted task has finished
+    void wait();
+
+private:
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    std::vector<Worker*> workers_;
+    std::vector<std::thread> threads_;
+    // Next worker to give a submitted task to
+    unsigned nextWorker_;
+
+    // Guards the counts below, and is waited on by idle workers and wait()
+    std::mutex lock_;
+    std::condition_variable workAvailable_;
+    std::condition_variable allDone_;
+    unsigned queued_;
+    unsigned pending_;
+    bool stopping_;
+
+    void workerLoop(unsigned idx);
+    // Takes a task from worker idx's queue or steals one, NULL if none
+    Task* takeTask(unsigned idx);
+
+    ThreadPool(const ThreadPool &);
+};
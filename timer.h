@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+
+// Returns the time in seconds from a monotonic clock with an arbitrary start
+double get_time();
+// The same clock in nanoseconds
+uint64_t get_time_ns();
@@ -0,0 +1,361 @@
+#include "trace.h"
+#include "timer.h"
+#include "Fighter.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+static const TraceTypeInfo traceTypes[] =
+{
+    { "status", TRACE_FIGHTER, 7,
+        { "damage", "x", "y", "xvel", "yvel", "attacking", "dir" } },
+    { "ground", TRACE_STATE, 2, { "jumpTime", "dashTime" } },
+    { "airNormal", TRACE_STATE, 2, { "jumpTime", "canSecondJump" } },
+    { "airStunned", TRACE_STATE, 2, { "stunTime", "stunDuration" } },
+
+    { "processInput", TRACE_SPANS, 0, { NULL } },
+    { "Match::update", TRACE_SPANS, 0, { NULL } },
+    { "Fighter::update", TRACE_SPANS, 0, { NULL } },
+    { "collision", TRACE_SPANS, 0, { NULL } },
+    { "render", TRACE_SPANS, 0, { NULL } },
+    { "ExplosionManager::render", TRACE_SPANS, 0, { NULL } },
+    { "hud", TRACE_SPANS, 0, { NULL } },
+    { "swap", TRACE_SPANS, 0, { NULL } },
+    { "rollback", TRACE_SPANS, 0, { NULL } },
+
+    { "stateChange", TRACE_EVENTS, 2, { "from", "to" } },
+    { "hit", TRACE_EVENTS, 3, { "attacker", "damage", "stun" } },
+    { "ko", TRACE_EVENTS, 2, { "lastHitBy", "lives" } },
+};
+// Fails to compile if the table and TraceType get out of step
+typedef char traceTypesCheck[
+    sizeof(traceTypes) / sizeof(traceTypes[0]) == NUM_TRACE_TYPES ? 1 : -1];
+
+static const struct
+{
+    const char *name;
+    TraceCategory category;
+} categoryNames[] =
+{
+    { "fighter", TRACE_FIGHTER },
+    { "state", TRACE_STATE },
+    { "span", TRACE_SPANS },
+    { "event", TRACE_EVENTS },
+    { "all", TRACE_ALL },
+};
+
+// Names of FighterStateIDs, for state change events
+static const char *stateNames[] =
+{
+    "GroundState", "AirNormalState", "AirStunnedState", "DeadState"
+};
+typedef char stateNamesCheck[
+    sizeof(stateNames) / sizeof(stateNames[0]) == DEAD_STATE + 1 ? 1 : -1];
+
+static const char *phaseNames[] = { "instant", "begin", "end" };
+static const char chromePhases[] = { 'i', 'B', 'E' };
+
+// 3MB per traced thread, half of which is a few milliseconds of a headless
+// match traced with every category on
+static const unsigned RING_SIZE = 65536; // must be a power of 2
+// The writer drains the rings this often, or as soon as a ring fills past
+// the high-water mark, so a busy thread doesn't fill its ring in between
+static const std::chrono::milliseconds WRITER_PERIOD(10);
+static const unsigned RING_HIGH_WATER = RING_SIZE / 2;
+
+// Single producer, single consumer: head is only written by the thread that
+// owns the ring, tail only by the writer
+struct TraceRing
+{
+    TraceRecord records[RING_SIZE];
+    std::atomic<unsigned> head;
+    std::atomic<unsigned> tail;
+    std::atomic<unsigned long> dropped;
+    uint32_t thread;
+    // Spans begun and not yet ended, only used by the owning thread.  This
+    // many slots are kept free for their ends.
+    unsigned openSpans;
+};
+
+std::atomic<unsigned> traceCategories(0);
+static unsigned traceFilter = TRACE_ALL;
+
+// Rings are never freed, a thread may still hold its pointer after a close
+static std::mutex ringsLock;
+static std::vector<TraceRing*> rings;
+static thread_local TraceRing *threadRing = NULL;
+
+static FILE *traceFile = NULL;
+static std::thread writerThread;
+static std::atomic<bool> writerRunning(false);
+// Set by a thread whose ring passed the high-water mark.  The lock only
+// guards the writer's wait, tracing threads never take it, so a wakeup can
+// be missed and the writer then waits out the rest of its period.
+static std::atomic<bool> drainWanted(false);
+static std::mutex writerLock;
+static std::condition_variable writerWake;
+
+static TraceRing *getRing()
+{
+    if (!threadRing)
+    {
+        TraceRing *ring = new TraceRing();
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->openSpans = 0;
+        std::lock_guard<std::mutex> guard(ringsLock);
+        ring->thread = rings.size();
+        rings.push_back(ring);
+        threadRing = ring;
+    }
+    return threadRing;
+}
+
+void trace_record(TraceType type, int id, const float *values, unsigned numValues)
+{
+    if (trace_enabled(traceTypes[type].category))
+        trace_write(TRACE_INSTANT, type, id, values, numValues);
+}
+
+bool trace_write(TracePhase phase, TraceType type, int id, const float *values,
+        unsigned numValues)
+{
+    TraceRing *ring = getRing();
+    unsigned head = ring->head.load(std::memory_order_relaxed);
+    unsigned room = RING_SIZE - (head - ring->tail.load(std::memory_order_acquire));
+    // An end uses its own reserved slot, a beginning needs one more for
+    // its end
+    unsigned needed = phase == TRACE_END ? 1
+        : ring->openSpans + (phase == TRACE_BEGIN ? 2 : 1);
+    if (room < needed)
+    {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (phase == TRACE_BEGIN)
+        ring->openSpans++;
+    else if (phase == TRACE_END && ring->openSpans > 0)
+        ring->openSpans--;
+    TraceRecord &record = ring->records[head % RING_SIZE];
+    record.time = get_time_ns();
+    record.type = type;
+    record.category = traceTypes[type].category;
+    record.phase = phase;
+    record.thread = ring->thread;
+    record.id = id;
+    numValues = std::min(numValues, TRACE_MAX_VALUES);
+    if (numValues)
+        memcpy(record.values, values, numValues * sizeof(float));
+    memset(record.values + numValues, 0,
+            (TRACE_MAX_VALUES - numValues) * sizeof(float));
+    ring->head.store(head + 1, std::memory_order_release);
+    // Only when crossing the mark, so a full ring doesn't notify every time
+    if (RING_SIZE - room + 1 == RING_HIGH_WATER)
+    {
+        drainWanted.store(true, std::memory_order_relaxed);
+        writerWake.notify_one();
+    }
+    return true;
+}
+
+// Writes out every ring's records
+static void drainRings()
+{
+    std::vector<TraceRing*> current;
+    {
+        std::lock_guard<std::mutex> guard(ringsLock);
+        current = rings;
+    }
+    for (unsigned i = 0; i < current.size(); i++)
+    {
+        TraceRing *ring = current[i];
+        unsigned tail = ring->tail.load(std::memory_order_relaxed);
+        unsigned head = ring->head.load(std::memory_order_acquire);
+        // Up to the end of the ring, then from its start
+        while (tail != head)
+        {
+            unsigned start = tail % RING_SIZE;
+            unsigned n = std::min(head - tail, RING_SIZE - start);
+            fwrite(&ring->records[start], sizeof(TraceRecord), n, traceFile);
+            tail += n;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+}
+
+static void writerMain()
+{
+    while (writerRunning.load(std::memory_order_relaxed))
+    {
+        drainRings();
+        // Waking early, spuriously or not, only drains sooner
+        std::unique_lock<std::mutex> guard(writerLock);
+        if (!drainWanted.exchange(false, std::memory_order_relaxed)
+                && writerRunning.load(std::memory_order_relaxed))
+            writerWake.wait_for(guard, WRITER_PERIOD);
+    }
+}
+
+bool trace_open(const char *filename)
+{
+    if (traceFile)
+        trace_close();
+    traceFile = fopen(filename, "wb");
+    if (!traceFile)
+    {
+        std::cerr << "Unable to open " << filename << " for tracing\n";
+        return false;
+    }
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    fwrite(&header, sizeof(header), 1, traceFile);
+
+    // Throw away anything left over from before a previous close
+    {
+        std::lock_guard<std::mutex> guard(ringsLock);
+        for (unsigned i = 0; i < rings.size(); i++)
+            rings[i]->tail.store(rings[i]->head.load(std::memory_order_acquire),
+                    std::memory_order_release);
+    }
+
+    writerRunning = true;
+    writerThread = std::thread(writerMain);
+    traceCategories = traceFilter;
+    return true;
+}
+
+void trace_close()
+{
+    if (!traceFile)
+        return;
+    traceCategories = 0;
+    writerRunning = false;
+    writerWake.notify_one();
+    writerThread.join();
+    drainRings();
+    fclose(traceFile);
+    traceFile = NULL;
+
+    unsigned long dropped = 0;
+    std::lock_guard<std::mutex> guard(ringsLock);
+    for (unsigned i = 0; i < rings.size(); i++)
+        dropped += rings[i]->dropped.exchange(0);
+    if (dropped)
+        std::cout << "Trace buffers were full, dropped " << dropped << " records\n";
+}
+
+void set_trace_categories(unsigned categories)
+{
+    traceFilter = categories;
+    if (traceFile)
+        traceCategories = categories;
+}
+
+bool parse_trace_categories(const char *list, unsigned *categories)
+{
+    std::stringstream ss(list);
+    std::string name;
+    unsigned mask = 0;
+    while (std::getline(ss, name, ','))
+    {
+        unsigned i = 0;
+        for (; i < sizeof(categoryNames) / sizeof(categoryNames[0]); i++)
+            if (name == categoryNames[i].name)
+                break;
+        if (i == sizeof(categoryNames) / sizeof(categoryNames[0]))
+        {
+            std::cerr << "Unknown trace category " << name << '\n';
+            return false;
+        }
+        mask |= categoryNames[i].category;
+    }
+    *categories = mask;
+    return true;
+}
+
+const TraceTypeInfo *trace_type_info(unsigned type)
+{
+    return type < NUM_TRACE_TYPES ? &traceTypes[type] : NULL;
+}
+
+static const char *categoryName(unsigned category)
+{
+    for (unsigned i = 0; i < sizeof(categoryNames) / sizeof(categoryNames[0]); i++)
+        if (categoryNames[i].category == category)
+            return categoryNames[i].name;
+    return "unknown";
+}
+
+static const char *stateName(float id)
+{
+    unsigned i = id;
+    return i < sizeof(stateNames) / sizeof(stateNames[0]) ? stateNames[i] : "unknown";
+}
+
+void print_trace_record(FILE *file, const TraceRecord &record, uint64_t start)
+{
+    fprintf(file, "%12.6f t%u ", (int64_t)(record.time - start) * 1e-9,
+            record.thread);
+    const TraceTypeInfo *info = trace_type_info(record.type);
+    if (!info || record.phase > TRACE_END)
+    {
+        fprintf(file, "unknown type %u\n", record.type);
+        return;
+    }
+    if (record.phase != TRACE_INSTANT)
+        fprintf(file, "%-5s ", phaseNames[record.phase]);
+    fprintf(file, "%-10s %d", info->name, record.id);
+    if (record.type == TRACE_STATE_CHANGE)
+        fprintf(file, "  %s -> %s", stateName(record.values[0]),
+                stateName(record.values[1]));
+    for (unsigned i = 0; i < info->numValues; i++)
+        fprintf(file, "  %s: %f", info->valueNames[i], record.values[i]);
+    fprintf(file, "\n");
+}
+
+bool print_chrome_trace_event(FILE *file, const TraceRecord &record,
+        uint64_t start, bool first)
+{
+    const TraceTypeInfo *info = trace_type_info(record.type);
+    if (!info || record.phase > TRACE_END)
+        return false;
+    if (!first)
+        fprintf(file, ",\n");
+
+    fprintf(file, "{\"name\":\"");
+    if (record.type == TRACE_STATE_CHANGE)
+        fprintf(file, "%s -> %s", stateName(record.values[0]),
+                stateName(record.values[1]));
+    else
+        fprintf(file, "%s", info->name);
+    // Timestamps are in microseconds
+    fprintf(file, "\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",
+            categoryName(record.category), chromePhases[record.phase],
+            (int64_t)(record.time - start) * 1e-3, record.thread);
+    // Instants are drawn across just their thread
+    if (record.phase == TRACE_INSTANT)
+        fprintf(file, ",\"s\":\"t\"");
+    fprintf(file, ",\"args\":{\"id\":%d", record.id);
+    for (unsigned i = 0; i < info->numValues; i++)
+    {
+        // JSON has no infinities or NaNs
+        if (std::isfinite(record.values[i]))
+            fprintf(file, ",\"%s\":%g", info->valueNames[i], record.values[i]);
+        else
+            fprintf(file, ",\"%s\":null", info->valueNames[i]);
+    }
+    fprintf(file, "}}");
+    return true;
+}
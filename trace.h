@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdio>
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Binary trace log.  Each thread writes fixed size records into its own
+ * lock free ring, and a background thread drains the rings to a file, so
+ * tracing never blocks or does I/O on the thread being traced.  A full ring
+ * drops records.  Categories can be switched on and off at any time, and
+ * while a category is off tracing it costs one relaxed load.  ssb-trace
+ * decodes a trace file to text.
+ */
+
+enum TraceCategory
+{
+    TRACE_FIGHTER = 1 << 0,
+    TRACE_STATE = 1 << 1,
+    // Every span type is in this category
+    TRACE_SPANS = 1 << 2,
+    TRACE_EVENTS = 1 << 3,
+    TRACE_ALL = (1 << 4) - 1
+};
+
+enum TraceType
+{
+    // damage, x, y, xvel, yvel, attacking, dir
+    TRACE_FIGHTER_STATUS,
+    // jumpTime, dashTime
+    TRACE_GROUND_STATE,
+    // jumpTime, canSecondJump
+    TRACE_AIR_NORMAL_STATE,
+    // stunTime, stunDuration
+    TRACE_AIR_STUNNED_STATE,
+
+    // Spans, with no values
+    TRACE_INPUT_SPAN,
+    TRACE_MATCH_UPDATE_SPAN,
+    TRACE_FIGHTER_UPDATE_SPAN,
+    TRACE_COLLISION_SPAN,
+    TRACE_RENDER_SPAN,
+    TRACE_EXPLOSIONS_RENDER_SPAN,
+    TRACE_HUD_SPAN,
+    TRACE_SWAP_SPAN,
+    TRACE_ROLLBACK_SPAN,
+
+    // Events
+    // from, to, as FighterStateIDs
+    TRACE_STATE_CHANGE,
+    // attacker, damage, stun, on the fighter that was hit
+    TRACE_HIT,
+    // lastHitBy, or -1, and lives left
+    TRACE_KO,
+    NUM_TRACE_TYPES
+};
+
+// Whether a record is a point in time or starts or ends a span
+enum TracePhase
+{
+    TRACE_INSTANT,
+    TRACE_BEGIN,
+    TRACE_END
+};
+
+static const unsigned TRACE_MAX_VALUES = 7;
+
+struct TraceRecord
+{
+    // Nanoseconds on the monotonic clock
+    uint64_t time;
+    uint16_t type;
+    uint8_t category;
+    uint8_t phase;
+    // Order the thread first traced in, starting from 0
+    uint32_t thread;
+    // What the record is about, a player number for fighter records
+    int32_t id;
+    float values[TRACE_MAX_VALUES];
+};
+
+// A trace file is a TraceHeader followed by TraceRecords.  Each thread's
+// records are in order, but threads' records are interleaved in chunks.
+static const char TRACE_MAGIC[4] = { 'G', 'S', 'T', 'R' };
+static const uint32_t TRACE_VERSION = 3;
+
+struct TraceHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t pad;
+};
+
+// How a type is decoded, valueNames has one name per value
+struct TraceTypeInfo
+{
+    const char *name;
+    TraceCategory category;
+    unsigned numValues;
+    const char *valueNames[TRACE_MAX_VALUES];
+};
+
+extern std::atomic<unsigned> traceCategories;
+
+inline bool trace_enabled(unsigned category)
+{
+    return traceCategories.load(std::memory_order_relaxed) & category;
+}
+
+// Starts writing records to filename, returns false if it can't be opened
+bool trace_open(const char *filename);
+// Writes out everything traced so far and stops tracing
+void trace_close();
+// Sets which categories are traced, takes effect once a trace is open
+void set_trace_categories(unsigned categories);
+// Parses a comma separated list of category names, or "all"
+bool parse_trace_categories(const char *list, unsigned *categories);
+
+// Records up to TRACE_MAX_VALUES values if type's category is enabled
+void trace_record(TraceType type, int id, const float *values, unsigned numValues);
+// Records whether or not the category is enabled.  Returns false if the
+// record was dropped because the ring was full.  Room is always kept for
+// the ends of the spans a thread has open, so an end is never dropped.
+bool trace_write(TracePhase phase, TraceType type, int id, const float *values,
+        unsigned numValues);
+
+const TraceTypeInfo *trace_type_info(unsigned type);
+// Prints a record as one line of text, in seconds relative to start
+void print_trace_record(FILE *file, const TraceRecord &record, uint64_t start);
+// Prints a record as a Chrome trace event, for loading the trace into
+// chrome://tracing or Perfetto.  Events after the first need a comma before.
+// Returns false if the record's type or phase is unknown and nothing was
+// printed.
+bool print_chrome_trace_event(FILE *file, const TraceRecord &record,
+        uint64_t start, bool first);
+
+// Records a span from construction to destruction if spans are enabled
+class TraceScope
+{
+public:
+    explicit TraceScope(TraceType type, int id = -1) :
+        type_(type), id_(id), enabled_(trace_enabled(TRACE_SPANS))
+    {
+        if (enabled_)
+            enabled_ = trace_write(TRACE_BEGIN, type_, id_, NULL, 0);
+    }
+    // Only written if the beginning was, so spans stay matched
+    ~TraceScope()
+    {
+        if (enabled_)
+            trace_write(TRACE_END, type_, id_, NULL, 0);
+    }
+
+private:
+    TraceType type_;
+    int id_;
+    bool enabled_;
+};
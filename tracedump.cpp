@@ -0,0 +1,72 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "trace.h"
+
+/*
+ * Decodes a trace written by ssb --trace to text, one record per line, with
+ * times in seconds from the earliest record in the file.  With --chrome it
+ * writes Chrome trace event JSON instead, which chrome://tracing and
+ * Perfetto load.  Only records in the given categories are printed.
+ */
+
+int main(int argc, char **argv)
+{
+    bool chrome = argc > 1 && std::string(argv[1]) == "--chrome";
+    int argi = chrome ? 2 : 1;
+    unsigned categories = TRACE_ALL;
+    if (argc - argi < 1 || argc - argi > 2
+            || (argc - argi == 2 && !parse_trace_categories(argv[argi + 1], &categories)))
+    {
+        std::cout << "usage: " << argv[0] << " [--chrome] TRACE [CATEGORY,...]\n";
+        return 1;
+    }
+
+    FILE *file = fopen(argv[argi], "rb");
+    if (!file)
+    {
+        std::cerr << "Unable to open " << argv[argi] << '\n';
+        return 1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+            || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))
+            || header.version != TRACE_VERSION
+            || header.recordSize != sizeof(TraceRecord))
+    {
+        std::cerr << argv[argi] << " is not a trace, or is from another version\n";
+        fclose(file);
+        return 1;
+    }
+
+    // Threads flush their rings in chunks, so records aren't in time order
+    // and the earliest can be anywhere.  Find it first so no time is negative.
+    TraceRecord record;
+    long recordsStart = ftell(file);
+    bool first = true, firstPrinted = true;
+    uint64_t start = 0;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (first || record.time < start)
+            start = record.time;
+        first = false;
+    }
+    fseek(file, recordsStart, SEEK_SET);
+
+    if (chrome)
+        printf("{\"traceEvents\":[\n");
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (!(record.category & categories))
+            continue;
+        if (!chrome)
+            print_trace_record(stdout, record, start);
+        else if (print_chrome_trace_event(stdout, record, start, firstPrinted))
+            firstPrinted = false;
+    }
+    if (chrome)
+        printf("\n]}\n");
+    fclose(file);
+    return 0;
+}
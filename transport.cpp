@@ -0,0 +1,166 @@
+#include "transport.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+// UdpTransport class methods
+// ----------------------------------------------------------------------------
+
+UdpTransport::UdpTransport() :
+    fd_(-1)
+{}
+
+UdpTransport::~UdpTransport()
+{
+    close();
+}
+
+bool UdpTransport::open(unsigned short localPort, const char *remoteHost,
+        unsigned short remotePort)
+{
+    close();
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", remotePort);
+    addrinfo *remote;
+    int err = getaddrinfo(remoteHost, port, &hints, &remote);
+    if (err != 0)
+    {
+        std::cerr << "Unable to find " << remoteHost << ": " << gai_strerror(err) << '\n';
+        return false;
+    }
+
+    fd_ = socket(remote->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0)
+    {
+        std::cerr << "Unable to create a UDP socket: " << strerror(errno) << '\n';
+        freeaddrinfo(remote);
+        return false;
+    }
+
+    // Bind the local port in the same family as the remote address
+    addrinfo *local;
+    hints.ai_family = remote->ai_family;
+    hints.ai_flags = AI_PASSIVE;
+    snprintf(port, sizeof(port), "%u", localPort);
+    if (getaddrinfo(NULL, port, &hints, &local) != 0)
+    {
+        freeaddrinfo(remote);
+        close();
+        return false;
+    }
+    bool ok = bind(fd_, local->ai_addr, local->ai_addrlen) == 0;
+    freeaddrinfo(local);
+    if (!ok)
+        std::cerr << "Unable to bind UDP port " << localPort << ": " << strerror(errno) << '\n';
+    // Connected, so only the remote's packets are received
+    else if (::connect(fd_, remote->ai_addr, remote->ai_addrlen) != 0)
+    {
+        std::cerr << "Unable to connect to " << remoteHost << ": " << strerror(errno) << '\n';
+        ok = false;
+    }
+    freeaddrinfo(remote);
+    if (!ok)
+        close();
+    return ok;
+}
+
+void UdpTransport::close()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+}
+
+bool UdpTransport::send(const void *data, size_t size)
+{
+    if (fd_ < 0)
+        return false;
+    // Nobody listening yet, or a full buffer, is just a lost packet
+    if (::send(fd_, data, size, 0) < 0 && errno != ECONNREFUSED
+            && errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+    return true;
+}
+
+size_t UdpTransport::receive(void *buffer, size_t size)
+{
+    if (fd_ < 0)
+        return 0;
+    for (;;)
+    {
+        ssize_t n = recv(fd_, buffer, size, 0);
+        if (n > 0)
+            return n;
+        // Errors from earlier sends are reported here, skip past them
+        if (n < 0 && errno == ECONNREFUSED)
+            continue;
+        return 0;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// LoopbackTransport class methods
+// ----------------------------------------------------------------------------
+
+LoopbackTransport::LoopbackTransport(float latency, float jitter, float loss,
+        unsigned seed) :
+    latency_(latency), jitter_(jitter), loss_(loss), seed_(seed),
+    now_(0.0), peer_(NULL)
+{}
+
+void LoopbackTransport::connect(LoopbackTransport &a, LoopbackTransport &b)
+{
+    a.peer_ = &b;
+    b.peer_ = &a;
+}
+
+void LoopbackTransport::setTime(double now)
+{
+    now_ = now;
+}
+
+bool LoopbackTransport::send(const void *data, size_t size)
+{
+    if (!peer_)
+        return false;
+    if (rand_r(&seed_) < loss_ * RAND_MAX)
+        return true;
+
+    Packet packet;
+    packet.arrival = now_ + latency_ + jitter_ * rand_r(&seed_) / RAND_MAX;
+    packet.data.assign((const char *) data, size);
+    std::lock_guard<std::mutex> guard(peer_->lock_);
+    peer_->inbox_.push_back(packet);
+    return true;
+}
+
+size_t LoopbackTransport::receive(void *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    // Earliest packet that has arrived
+    int next = -1;
+    for (unsigned i = 0; i < inbox_.size(); i++)
+        if (inbox_[i].arrival <= now_
+                && (next < 0 || inbox_[i].arrival < inbox_[next].arrival))
+            next = i;
+    if (next < 0)
+        return 0;
+
+    size_t n = std::min(size, inbox_[next].data.size());
+    memcpy(buffer, inbox_[next].data.data(), n);
+    inbox_[next] = inbox_.back();
+    inbox_.pop_back();
+    return n;
+}
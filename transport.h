@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <mutex>
+
+/*
+ * Unreliable, unordered packet delivery between two netplay peers.  Neither
+ * call blocks.  UdpTransport is the real thing, LoopbackTransport connects
+ * two peers in one process and adds latency, jitter and loss so netplay can
+ * be tested on one machine.
+ */
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    // Sends one packet, which may be lost.  Returns false on a local error.
+    virtual bool send(const void *data, size_t size) = 0;
+    // Copies the next waiting packet into buffer and returns its size, or 0
+    // if there is none
+    virtual size_t receive(void *buffer, size_t size) = 0;
+};
+
+class UdpTransport : public Transport
+{
+public:
+    UdpTransport();
+    virtual ~UdpTransport();
+
+    // Binds localPort and sends to remoteHost:remotePort, returns false if
+    // either fails
+    bool open(unsigned short localPort, const char *remoteHost,
+            unsigned short remotePort);
+    void close();
+
+    virtual bool send(const void *data, size_t size);
+    virtual size_t receive(void *buffer, size_t size);
+
+private:
+    int fd_;
+
+    UdpTransport(const UdpTransport &);
+};
+
+class LoopbackTransport : public Transport
+{
+public:
+    // Each packet sent takes latency plus up to jitter seconds to arrive, so
+    // packets can arrive out of order, and loss of them never arrive
+    LoopbackTransport(float latency, float jitter, float loss, unsigned seed);
+
+    // Connects a and b to each other
+    static void connect(LoopbackTransport &a, LoopbackTransport &b);
+    // Sets the time in seconds, packets are delivered once it passes their
+    // arrival time.  Both ends must be given the same clock.
+    void setTime(double now);
+
+    virtual bool send(const void *data, size_t size);
+    virtual size_t receive(void *buffer, size_t size);
+
+private:
+    struct Packet
+    {
+        double arrival;
+        std::string data;
+    };
+
+    float latency_, jitter_, loss_;
+    unsigned seed_;
+    double now_;
+    LoopbackTransport *peer_;
+
+    // Packets on their way to this end, guarded by lock_ as the peer may be
+    // on another thread
+    std::mutex lock_;
+    std::vector<Packet> inbox_;
+
+    LoopbackTransport(const LoopbackTransport &);
+};
@@ -2,6 +2,8 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include "archive.h"
 
 /*
  * Boring, non-OpenGL-related utility functions
@@ -9,9 +11,21 @@
 
 void *file_contents(const char *filename, GLint *length)
 {
-    FILE *f = fopen(filename, "r");
+    FILE *f;
     void *buffer;
+    size_t size;
+    const void *packed = find_asset(filename, &size);
+
+    // Callers own the result, so even packed files are copied
+    if (packed) {
+        buffer = malloc(size+1);
+        memcpy(buffer, packed, size);
+        ((char*)buffer)[size] = '\0';
+        *length = size;
+        return buffer;
+    }
 
+    f = fopen(filename, "rb");
     if (!f) {
         fprintf(stderr, "Unable to open %s for reading\n", filename);
         return NULL;
@@ -34,7 +48,8 @@ static short le_short(unsigned char *bytes)
     return bytes[0] | ((char)bytes[1] << 8);
 }
 
-void *read_tga(const char *filename, int *width, int *height)
+const void *parse_tga(const void *data, size_t size, const char *name,
+        int *width, int *height)
 {
     struct tga_header {
        char  id_length;
@@ -50,64 +65,65 @@ void *read_tga(const char *filename, int *width, int *height)
        char  bits_per_pixel;
        char  image_descriptor;
     } header;
-    int i, color_map_size, pixels_size;
-    FILE *f;
-    size_t read;
-    void *pixels;
-
-    f = fopen(filename, "rb");
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t offset, color_map_size, pixels_size;
 
-    if (!f) {
-        fprintf(stderr, "Unable to open %s for reading\n", filename);
-        return NULL;
-    }
-
-    read = fread(&header, 1, sizeof(header), f);
-
-    if (read != sizeof(header)) {
-        fprintf(stderr, "%s has incomplete tga header\n", filename);
-        fclose(f);
+    if (size < sizeof(header)) {
+        fprintf(stderr, "%s has incomplete tga header\n", name);
         return NULL;
     }
+    memcpy(&header, bytes, sizeof(header));
     if (header.data_type_code != 2) {
-        fprintf(stderr, "%s is not an uncompressed RGB tga file\n", filename);
-        fclose(f);
+        fprintf(stderr, "%s is not an uncompressed RGB tga file\n", name);
         return NULL;
     }
     if (header.bits_per_pixel != 24) {
-        fprintf(stderr, "%s is not a 24-bit uncompressed RGB tga file\n", filename);
-        fclose(f);
+        fprintf(stderr, "%s is not a 24-bit uncompressed RGB tga file\n", name);
         return NULL;
     }
 
-    for (i = 0; i < header.id_length; ++i)
-        if (getc(f) == EOF) {
-            fprintf(stderr, "%s has incomplete id string\n", filename);
-            fclose(f);
-            return NULL;
-        }
-
+    // Skip the id string and color map
+    offset = sizeof(header) + (unsigned char)header.id_length;
+    if (offset > size) {
+        fprintf(stderr, "%s has incomplete id string\n", name);
+        return NULL;
+    }
     color_map_size = le_short(header.color_map_length) * (header.color_map_depth/8);
-    for (i = 0; i < color_map_size; ++i)
-        if (getc(f) == EOF) {
-            fprintf(stderr, "%s has incomplete color map\n", filename);
-            fclose(f);
-            return NULL;
-        }
+    offset += color_map_size;
+    if (offset > size) {
+        fprintf(stderr, "%s has incomplete color map\n", name);
+        return NULL;
+    }
 
     *width = le_short(header.width); *height = le_short(header.height);
     pixels_size = *width * *height * (header.bits_per_pixel/8);
-    pixels = malloc(pixels_size);
-
-    read = fread(pixels, 1, pixels_size, f);
-
-    if (read != pixels_size) {
-        fprintf(stderr, "%s has incomplete image\n", filename);
-        fclose(f);
-        free(pixels);
+    if (size - offset < pixels_size) {
+        fprintf(stderr, "%s has incomplete image\n", name);
         return NULL;
     }
+    return bytes + offset;
+}
 
+void *decode_tga(const void *data, size_t size, const char *name,
+        int *width, int *height)
+{
+    const void *image = parse_tga(data, size, name, width, height);
+    if (!image)
+        return NULL;
+    size_t pixels_size = *width * *height * 3;
+    void *pixels = malloc(pixels_size);
+    memcpy(pixels, image, pixels_size);
     return pixels;
 }
 
+void *read_tga(const char *filename, int *width, int *height)
+{
+    // One read of the whole file, then decode from memory
+    GLint length;
+    void *data = file_contents(filename, &length);
+    if (!data)
+        return NULL;
+    void *pixels = decode_tga(data, length, filename, width, height);
+    free(data);
+    return pixels;
+}
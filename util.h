@@ -1,3 +1,11 @@
+#include <cstddef>
+
 void *file_contents(const char *filename, GLint *length);
+// Checks an uncompressed 24 bit tga already in memory, name is only used in
+// error messages.  Returns a pointer to the BGR pixels within data, or NULL.
+const void *parse_tga(const void *data, size_t size, const char *name,
+        int *width, int *height);
+// As parse_tga, but returns a malloc'd copy of the pixels
+void *decode_tga(const void *data, size_t size, const char *name,
+        int *width, int *height);
 void *read_tga(const char *filename, int *width, int *height);
-